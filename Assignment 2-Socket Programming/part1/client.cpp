@@ -1,14 +1,15 @@
 #include <iostream>
-#include <map>
 #include <string>
 #include <cstring>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include "json.hpp"
+#include "word_table.hpp"
+#include "frequency.hpp"
+#include "reply_tokenizer.hpp"
 #include <chrono>
 #include <fstream>
-#include <sstream>
 #include <vector>
 #include <algorithm>
 
@@ -29,15 +30,15 @@ json readConfig(const string& filename) {
     return config;
 }
 
-// Function to dump word frequencies into a file
-void dumpWordFrequencies(const map<string, int>& word_count, const string& filename) {
+// Function to dump word frequencies into a file, sorted by word
+void dumpWordFrequencies(const WordTable& word_count, const string& filename) {
     ofstream out_file(filename);
     if (!out_file.is_open()) {
         cerr << "[CLIENT] Failed to open file for dumping word counts: " << filename << endl;
         return;
     }
 
-    for (const auto& entry : word_count) {
+    for (const auto& entry : word_count.sorted()) {
         if (entry.first != "EOF" && entry.first != "$$") { // Exclude EOF and $$
             out_file << entry.first << ", " << entry.second << endl;
         }
@@ -47,6 +48,76 @@ void dumpWordFrequencies(const map<string, int>& word_count, const string& filen
     cout << "[CLIENT] Word frequencies dumped into file: " << filename << endl;
 }
 
+// Function to fetch the whole file with one STREAM request and count its words as they
+// arrive. Words split across reads are carried over by the tokenizer until their comma
+// comes in.
+// Returns false if the connection closes before EOF (or $$).
+bool fetchStream(int sock, WordTable& word_count) {
+    char buffer[BUFFER_SIZE];
+    ReplyTokenizer tokenizer;
+
+    string request = "STREAM 0\n";
+    send(sock, request.c_str(), request.size(), 0);
+    cout << "[CLIENT] Sent stream request from offset: 0" << endl;
+
+    while (true) {
+        int valread = recv(sock, buffer, BUFFER_SIZE, 0);
+        if (valread <= 0) {
+            cerr << "[CLIENT] Connection closed by server or error occurred." << endl;
+            return false;
+        }
+
+        bool finished = false;
+        tokenizer.feed(buffer, valread, [&](string_view word) {
+            word_count.add(word);
+        }, [&](string_view token) {
+            finished = finished || token == "EOF" || token == "$$";
+        });
+        if (finished) {
+            return true;
+        }
+    }
+}
+
+// Function to ask the server for the word counts of the whole file with one FREQ request
+// instead of downloading its words. The reply header gives the body size, so the body is
+// read whole and each "word, count" line added to word_count.
+// Returns false if the server refuses the request or the connection closes first.
+bool fetchFrequencies(int sock, WordTable& word_count) {
+    char buffer[BUFFER_SIZE];
+    send(sock, "FREQ\n", 5, 0);
+    cout << "[CLIENT] Sent request for word frequencies" << endl;
+
+    string reply;
+    size_t header_end = string::npos, distinct = 0, bytes = 0;
+    while (header_end == string::npos || reply.size() < header_end + 1 + bytes) {
+        int valread = recv(sock, buffer, BUFFER_SIZE, 0);
+        if (valread <= 0) {
+            cerr << "[CLIENT] Connection closed by server or error occurred." << endl;
+            return false;
+        }
+        reply.append(buffer, valread);
+
+        if (header_end == string::npos && (header_end = reply.find('\n')) != string::npos &&
+            !parse_frequency_header(reply.substr(0, header_end), distinct, bytes)) {
+            cerr << "[CLIENT] Server refused the frequency request: " << reply.substr(0, header_end) << endl;
+            return false;
+        }
+    }
+
+    string_view body(reply.data() + header_end + 1, bytes);
+    while (!body.empty()) {
+        size_t newline = body.find('\n');
+        string_view word;
+        uint64_t times;
+        if (parse_frequency_line(body.substr(0, newline), word, times)) {
+            word_count.add(word, times);
+        }
+        body.remove_prefix(newline == string_view::npos ? body.size() : newline + 1);
+    }
+    return true;
+}
+
 int main() {
     cout << "[CLIENT] Starting client..." << endl;
 
@@ -56,6 +127,8 @@ int main() {
     int server_port = config["server_port"];
     int k = config["k"];
     int p = config["p"];
+    bool stream = config.value("stream", false);  // Fetch the whole file with one request
+    bool frequencies = config.value("server_frequencies", false);  // Ask for the server's word counts instead
 
     cout << "[CLIENT] Loaded configuration: server_ip=" << server_ip 
          << ", server_port=" << server_port 
@@ -67,7 +140,7 @@ int main() {
     // Create TCP socket
     int sock = 0;
     struct sockaddr_in serv_addr;
-    char buffer[BUFFER_SIZE] = {0};
+    char buffer[BUFFER_SIZE];
 
     if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         cerr << "[CLIENT] Socket creation error" << endl;
@@ -92,11 +165,19 @@ int main() {
     cout << "[CLIENT] Connected to server at " << server_ip << ":" << server_port << endl;
 
     int offset = 0;
-    map<string, int> word_count;
+    WordTable word_count;
     bool done = false;
     auto start_time = chrono::high_resolution_clock::now();
 
-    string leftover = "";  // To handle incomplete words from the previous chunk
+    ReplyTokenizer tokenizer;  // Carries an incomplete word from one chunk to the next
+
+    if (frequencies) {
+        fetchFrequencies(sock, word_count);
+        done = true;
+    } else if (stream) {
+        fetchStream(sock, word_count);
+        done = true;
+    }
 
     while (!done) {
         // Prepare and send the request with the current offset
@@ -104,60 +185,44 @@ int main() {
         send(sock, request.c_str(), request.size(), 0);
         cout << "[CLIENT] Sent request for offset: " << offset << endl;
 
-        // Clear buffer and receive data
-        memset(buffer, 0, BUFFER_SIZE);
-        string response = "";
-
-        // Receive words in chunks (p words at a time)
+        // Receive words in chunks (p words at a time), counting each read as it arrives;
+        // a word cut off at the end of a read is finished by the next one
         int word_count_in_chunk = 0;
+        bool received = false;
+        string sentinel;
         while (true) {
-            memset(buffer, 0, BUFFER_SIZE);
-            int valread = recv(sock, buffer, BUFFER_SIZE - 1, 0);
+            int valread = recv(sock, buffer, BUFFER_SIZE, 0);
             if (valread <= 0) {
                 // Connection closed or error
                 cerr << "[CLIENT] Connection closed by server or error occurred." << endl;
                 done = true;
                 break;
             }
-            buffer[valread] = '\0';  // Null-terminate the received string
-            cout<<string(buffer);
-            response = string(buffer);
-            istringstream stream(response);
-            string word;
-            
-
-            // Keep track of leftover data
-            leftover = "";
-
-            while (getline(stream, word, ',')) {  // Split by commas
-                word.erase(remove_if(word.begin(), word.end(), ::isspace), word.end());  // Trim whitespace
-                if (!word.empty() && word != "EOF" && word != "$$") {  // Exclude EOF and $$
-                    word_count[word]++;
-                    word_count_in_chunk++;
+            received = true;
+            cout.write(buffer, valread);
+            tokenizer.feed(buffer, valread, [&](string_view word) {
+                word_count.add(word);
+                word_count_in_chunk++;
+            }, [&](string_view token) {
+                if (token == "EOF" || token == "$$") {
+                    sentinel = token;
                 }
-            }
+            });
 
-            // If we don't have enough words in the current chunk, save the remaining response
-            if (word_count_in_chunk >= k) {
-                // leftover = word;  // Save the leftover word if it's incomplete
-                
-                break;
+            // Check whether the reply ended with EOF or $$
+            if (sentinel == "$$") {
+                cout << "[CLIENT] Received $$, stopping processing for this chunk." << endl;
             }
-            // Check if the response contains EOF or $$
-            if (response.find("EOF") != string::npos) {
+            if (!sentinel.empty()) {
                 done = true;
                 break;
             }
-            if (response.find("$$") != string::npos) {
-                cout << "[CLIENT] Received $$, stopping processing for this chunk." << endl;
-                done = true;
-                break;  // Don't mark `done`, just break this inner loop to send the next request
-            }            
-
-            
+            if (word_count_in_chunk >= k) {
+                break;
+            }
         }
 
-        if (response.empty()) {
+        if (!received) {
             cerr << "[CLIENT] Received an empty response. Terminating." << endl;
             break;
         }
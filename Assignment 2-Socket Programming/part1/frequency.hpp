@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <cctype>
+#include "corpus.hpp"
+#include "word_table.hpp"
+
+// Frequency table reply, the answer to "FREQ [first [count]]": every distinct word among
+// count words from offset first (the whole file by default) with how often it occurs,
+// which is the table a client would otherwise build by downloading all those words.
+//
+//   FREQ <distinct words> <body bytes>\n
+//   word, count\n  (one line per word, sorted by word: the client's output file format)
+//
+// The header gives the body size, so a reader takes it whole without looking for a
+// sentinel. A first offset outside the file gets "$$\n" like an offset request.
+#define FREQUENCY_HEADER "FREQ"
+#define FREQUENCY_SLICE (1 << 20)  // Fewest words worth giving a counting thread of its own
+
+// Function to give a corpus word the form the clients count it in: whitespace is dropped,
+// so a word containing some is copied into scratch. An empty result is not a word.
+inline std::string_view normalize_word(std::string_view word, std::string& scratch) {
+    for (char c : word) {
+        if (isspace((unsigned char)c)) {
+            scratch.clear();
+            for (char d : word) {
+                if (!isspace((unsigned char)d)) {
+                    scratch += d;
+                }
+            }
+            return scratch;
+        }
+    }
+    return word;
+}
+
+// Function to count words [first, last) of the corpus. Large ranges are cut into slices
+// counted by up to threads threads, each into a table of its own, which are then merged
+// as a tree.
+inline WordTable count_words(const Corpus& words, size_t first, size_t last, int threads) {
+    size_t total = last > first ? last - first : 0;
+    size_t slices = std::max<size_t>(1, std::min<size_t>(threads, total / FREQUENCY_SLICE));
+
+    std::vector<WordTable> tables(slices);
+    std::vector<std::thread> counters;
+    for (size_t s = 0; s < slices; s++) {
+        size_t begin = first + total * s / slices, end = first + total * (s + 1) / slices;
+        auto count = [&words, &tables, s, begin, end]() {
+            std::string scratch;
+            for (size_t i = begin; i < end; i++) {
+                std::string_view word = normalize_word(words[i], scratch);
+                if (!word.empty()) {
+                    tables[s].add(word);
+                }
+            }
+        };
+        if (slices == 1) {
+            count();
+        } else {
+            counters.push_back(std::thread(count));
+        }
+    }
+    for (auto& t : counters) {
+        t.join();
+    }
+
+    merge_tables(tables);
+    return std::move(tables[0]);
+}
+
+// Function to serialize table as a frequency reply, header included
+inline std::string frequency_reply(const WordTable& table) {
+    std::string body;
+    auto entries = table.sorted();
+    for (const auto& entry : entries) {
+        body += entry.first;
+        body += ", ";
+        body += std::to_string(entry.second);
+        body += '\n';
+    }
+    return std::string(FREQUENCY_HEADER) + " " + std::to_string(entries.size()) + " " +
+           std::to_string(body.size()) + "\n" + body;
+}
+
+// Function to read a frequency reply header line (without its newline); false if line
+// is not one
+inline bool parse_frequency_header(const std::string& line, size_t& distinct, size_t& bytes) {
+    unsigned long long words_field, bytes_field;
+    char tail;
+    if (sscanf(line.c_str(), FREQUENCY_HEADER " %llu %llu%c", &words_field, &bytes_field, &tail) != 2) {
+        return false;
+    }
+    distinct = words_field;
+    bytes = bytes_field;
+    return true;
+}
+
+// Function to split one "word, count" line of a frequency reply body (without its newline)
+inline bool parse_frequency_line(std::string_view line, std::string_view& word, uint64_t& count) {
+    size_t separator = line.rfind(", ");
+    if (separator == std::string_view::npos || separator + 2 == line.size()) {
+        return false;
+    }
+    count = 0;
+    for (char c : line.substr(separator + 2)) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        count = count * 10 + (c - '0');
+    }
+    word = line.substr(0, separator);
+    return true;
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <charconv>
+#include <type_traits>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+
+// Asynchronous logger for the servers. LOG(level) << ... formats a line only when level is
+// enabled, and then only appends it to a ring owned by the calling thread: no lock, no
+// syscall, no flush. A background thread drains every ring each LOG_FLUSH_INTERVAL_MS,
+// sooner for a line at LOG_INFO or above or once a ring is half full, and writes what it
+// found with one write per stream: errors and warnings to stderr, the rest to stdout.
+// Lines from one thread keep their order; lines from different threads are only ordered
+// by when they were drained. A thread that logs faster than the flusher drains loses the
+// lines that do not fit, and the flusher reports how many. Lines queued in the last
+// interval before the process is killed are lost; a normal exit writes them all.
+enum LogLevel { LOG_ERROR, LOG_WARN, LOG_INFO, LOG_DEBUG };
+
+#define LOG_RING_SIZE (256 << 10)   // Bytes of lines each thread can have waiting (power of two)
+#define LOG_FLUSH_INTERVAL_MS 50
+#define LOG_RECORD_HEADER 5         // uint32 length and a level byte before each line
+
+#define LOG(level) if (!Logger::enabled(level)) {} else LogLine(level)
+
+// Single-producer single-consumer ring of log records: the owning thread pushes, the
+// flusher drains. Positions only grow; each is written by one side and read by the other.
+class LogRing {
+public:
+    // Function for the owning thread to add one line; false when it does not fit
+    bool push(LogLevel level, std::string_view line) {
+        uint64_t head = write_position.load(std::memory_order_relaxed);
+        uint64_t tail = read_position.load(std::memory_order_acquire);
+        size_t need = LOG_RECORD_HEADER + line.size();
+        if (need > LOG_RING_SIZE - (head - tail)) {
+            return false;
+        }
+        uint32_t length = line.size();
+        char header[LOG_RECORD_HEADER];
+        memcpy(header, &length, 4);
+        header[4] = (char)level;
+        copy_in(head, header, LOG_RECORD_HEADER);
+        copy_in(head + LOG_RECORD_HEADER, line.data(), line.size());
+        write_position.store(head + need, std::memory_order_release);
+        return true;
+    }
+
+    // Bytes queued; only a snapshot for the other side
+    size_t used() const {
+        return write_position.load(std::memory_order_relaxed) - read_position.load(std::memory_order_relaxed);
+    }
+
+    // Function for the flusher to move every complete line into out (LOG_INFO and below)
+    // or errors (LOG_WARN and above)
+    void drain(std::string& out, std::string& errors) {
+        uint64_t tail = read_position.load(std::memory_order_relaxed);
+        uint64_t head = write_position.load(std::memory_order_acquire);
+        while (tail < head) {
+            char header[LOG_RECORD_HEADER];
+            copy_out(tail, header, LOG_RECORD_HEADER);
+            uint32_t length;
+            memcpy(&length, header, 4);
+            std::string& target = header[4] <= LOG_WARN ? errors : out;
+            size_t start = target.size();
+            target.resize(start + length);
+            copy_out(tail + LOG_RECORD_HEADER, &target[start], length);
+            tail += LOG_RECORD_HEADER + length;
+        }
+        read_position.store(tail, std::memory_order_release);
+    }
+
+    std::atomic<bool> retired{false};     // The owning thread has exited
+    std::atomic<uint64_t> dropped{0};     // Lines that did not fit
+
+private:
+    static constexpr size_t MASK = LOG_RING_SIZE - 1;
+
+    void copy_in(uint64_t position, const char* bytes, size_t length) {
+        size_t index = position & MASK;
+        size_t first = length < LOG_RING_SIZE - index ? length : LOG_RING_SIZE - index;
+        memcpy(data + index, bytes, first);
+        memcpy(data, bytes + first, length - first);
+    }
+
+    void copy_out(uint64_t position, char* bytes, size_t length) const {
+        size_t index = position & MASK;
+        size_t first = length < LOG_RING_SIZE - index ? length : LOG_RING_SIZE - index;
+        memcpy(bytes, data + index, first);
+        memcpy(bytes + first, data, length - first);
+    }
+
+    char data[LOG_RING_SIZE];
+    alignas(64) std::atomic<uint64_t> write_position{0};
+    alignas(64) std::atomic<uint64_t> read_position{0};
+};
+
+class Logger {
+public:
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    static bool enabled(LogLevel level) {
+        return level <= current_level.load(std::memory_order_relaxed);
+    }
+
+    static void set_level(LogLevel level) {
+        current_level.store(level, std::memory_order_relaxed);
+    }
+
+    // Function to read a level name: "error", "warn", "info" or "debug"
+    static bool parse_level(const std::string& name, LogLevel& level) {
+        const char* names[] = {"error", "warn", "info", "debug"};
+        for (int i = 0; i <= LOG_DEBUG; i++) {
+            if (name == names[i]) {
+                level = (LogLevel)i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Function to queue one line (with its newline) from the calling thread
+    void write(LogLevel level, std::string_view line) {
+        LogRing& ring = local_ring();
+        if (!ring.push(level, line)) {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (level <= LOG_INFO || ring.used() > LOG_RING_SIZE / 2) {
+            wake.store(true, std::memory_order_relaxed);
+            wakeup.notify_one();
+        }
+    }
+
+    ~Logger() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        flusher.join();
+        drain_all();
+    }
+
+private:
+    Logger() : flusher([this]() { run(); }) {}
+
+    // Per-thread handle on its ring; marks the ring retired when the thread exits so the
+    // flusher drops it once drained
+    struct RingHolder {
+        std::shared_ptr<LogRing> ring;
+        ~RingHolder() {
+            if (ring != nullptr) {
+                ring->retired.store(true, std::memory_order_release);
+            }
+        }
+    };
+
+    LogRing& local_ring() {
+        thread_local RingHolder holder;
+        if (holder.ring == nullptr) {
+            holder.ring = std::make_shared<LogRing>();
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            rings.push_back(holder.ring);
+        }
+        return *holder.ring;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        while (!stopping) {
+            wakeup.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS), [this]() {
+                return stopping || wake.load(std::memory_order_relaxed);
+            });
+            wake.store(false, std::memory_order_relaxed);
+            lock.unlock();
+            drain_all();
+            lock.lock();
+        }
+    }
+
+    // Function to write every queued line, dropping the rings of threads that have exited
+    void drain_all() {
+        std::string out, errors;
+        uint64_t dropped = 0;
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            for (size_t i = 0; i < rings.size();) {
+                bool retired = rings[i]->retired.load(std::memory_order_acquire);
+                rings[i]->drain(out, errors);
+                dropped += rings[i]->dropped.exchange(0, std::memory_order_relaxed);
+                if (retired) {
+                    rings[i] = rings.back();
+                    rings.pop_back();
+                } else {
+                    i++;
+                }
+            }
+        }
+        if (dropped > 0) {
+            errors += "Log: " + std::to_string(dropped) + " lines dropped\n";
+        }
+        write_all(STDOUT_FILENO, out);
+        write_all(STDERR_FILENO, errors);
+    }
+
+    static void write_all(int fd, const std::string& text) {
+        size_t written = 0;
+        while (written < text.size()) {
+            ssize_t n = ::write(fd, text.data() + written, text.size() - written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return;
+            }
+            written += n;
+        }
+    }
+
+    static inline std::atomic<int> current_level{LOG_INFO};
+
+    std::mutex rings_mutex;
+    std::vector<std::shared_ptr<LogRing>> rings;
+    std::mutex wake_mutex;
+    std::condition_variable wakeup;
+    std::atomic<bool> wake{false};
+    bool stopping = false;
+    std::thread flusher;  // Last, so it starts once everything it uses is built
+};
+
+// One line being formatted; it is queued when the statement ends
+class LogLine {
+public:
+    explicit LogLine(LogLevel level) : level(level) {}
+
+    ~LogLine() {
+        text += '\n';
+        Logger::instance().write(level, text);
+    }
+
+    LogLine& operator<<(std::string_view value) {
+        text += value;
+        return *this;
+    }
+
+    LogLine& operator<<(const char* value) {
+        text += value;
+        return *this;
+    }
+
+    LogLine& operator<<(char value) {
+        text += value;
+        return *this;
+    }
+
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    LogLine& operator<<(T value) {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        text.append(digits, result.ptr);
+        return *this;
+    }
+
+private:
+    LogLevel level;
+    std::string text;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+// Streaming tokenizer for the text replies: words end at a comma, and a newline ends a line
+// whose leftover token is either empty or a sentinel (EOF, $$ or CAPPED). Any other token
+// before a newline is a word with a newline inside or at the end of it in the file (the
+// last word of a file ending in "end\n"), so it carries on to its comma with the newline
+// dropped, like any other whitespace. Bytes are scanned in place as each recv delivers
+// them and tokens are handed on as string_views into the receive buffer. Only a token cut
+// off by the end of a buffer, or one with whitespace inside it (which is dropped, as the
+// clients always did), is copied, into carry, so steady-state tokenizing allocates nothing
+// and a word split across TCP segments is still counted once, whole.
+class ReplyTokenizer {
+public:
+    // Function to tokenize the next length bytes of the stream, calling on_word(word) for
+    // every non-empty word and on_line(token) for every newline that ends an empty line
+    // or a sentinel
+    template <typename OnWord, typename OnLine>
+    void feed(const char* data, size_t length, OnWord on_word, OnLine on_line) {
+        size_t start = 0;  // Start of the current token's bytes within data
+        for (size_t i = 0; i < length; i++) {
+            unsigned char c = data[i];
+            if (!special[c]) {
+                continue;
+            }
+            if (c == ',') {
+                std::string_view token = take(data, start, i);
+                if (!token.empty()) {
+                    on_word(token);
+                }
+                carry.clear();
+            } else if (c == '\n') {
+                std::string_view token = take(data, start, i);
+                if (token.empty() || sentinel(token)) {
+                    on_line(token);
+                    carry.clear();
+                } else if (carry.empty()) {
+                    carry.append(token);  // Part of a word: keep it until the comma
+                }
+            } else {
+                carry.append(data + start, i - start);  // Whitespace: keep what came before it
+            }
+            start = i + 1;
+        }
+        carry.append(data + start, length - start);
+    }
+
+private:
+    // Function to get the token ending at data[end], joining it to the carried part if any
+    std::string_view take(const char* data, size_t start, size_t end) {
+        if (carry.empty()) {
+            return std::string_view(data + start, end - start);
+        }
+        carry.append(data + start, end - start);
+        return carry;
+    }
+
+    // Function to tell whether a token ending a line is one of the server's markers
+    static bool sentinel(std::string_view token) {
+        return token == "EOF" || token == "$$" || token == "CAPPED";
+    }
+
+    // Bytes that end or interrupt a token: comma, newline and the other isspace characters
+    struct SpecialBytes {
+        bool table[256] = {};
+        SpecialBytes() {
+            for (unsigned char c : std::string(",\n \t\r\v\f")) {
+                table[c] = true;
+            }
+        }
+        bool operator[](unsigned char c) const {
+            return table[c];
+        }
+    };
+    static inline const SpecialBytes special;
+
+    std::string carry;  // Start of a token that continues past the bytes fed so far
+};
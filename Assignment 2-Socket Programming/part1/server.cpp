@@ -1,4 +1,3 @@
-#include <iostream>
 #include <fstream>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -7,36 +6,95 @@
 #include <vector>
 #include <string>
 #include <cstring>
+#include <cerrno>
+#include <climits>
+#include <sys/uio.h>
+#include <sstream>
+#include <thread>
+#include <csignal>
 #include "json.hpp"
+#include "corpus.hpp"
+#include "frequency.hpp"
+#include "logger.hpp"
 
 #define BUFFER_SIZE 1024
 
 using namespace std;
 using json = nlohmann::json;
 
-// Function to split comma-separated words
-vector<string> split_words(const string &str) {
-    vector<string> words;
-    size_t start = 0, end = 0;
-    while ((end = str.find(',', start)) != string::npos) {
-        words.push_back(str.substr(start, end - start));
-        start = end + 1;
+// Function to describe the reply for one offset as a list of buffers: lines of p words
+// taken in place from the corpus, the last one ending in EOF when it reaches the end of
+// the file, so the whole reply can leave in one writev
+void gather_response(vector<iovec>& iov, const Corpus& words, int offset, int k, int p) {
+    size_t end = min<size_t>((size_t)offset + k, words.size());
+    for (size_t first = offset; first < end; first += p) {
+        size_t last = min<size_t>(first + p, end);
+        string_view run = words.run(first, last);
+        iov.push_back({(void*)run.data(), run.size()});
+        if (!words.comma_after(last - 1)) {
+            iov.push_back({(void*)",", 1});
+        }
+        if (last >= words.size()) {
+            iov.push_back({(void*)"EOF\n", 4});
+        } else {
+            iov.push_back({(void*)"\n", 1});
+        }
     }
-    if (start < str.size()) {
-        words.push_back(str.substr(start));
+}
+
+// Function to write every buffer in iov with one writev per IOV_MAX buffers; false means
+// the peer is gone
+bool send_iovecs(int fd, vector<iovec>& iov) {
+    size_t next = 0;
+    while (next < iov.size()) {
+        ssize_t n = writev(fd, iov.data() + next, min<size_t>(iov.size() - next, IOV_MAX));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+
+        // Skip the buffers that were written completely and trim a partial one
+        while (next < iov.size() && (size_t)n >= iov[next].iov_len) {
+            n -= iov[next].iov_len;
+            next++;
+        }
+        if (n > 0) {
+            iov[next].iov_base = (char*)iov[next].iov_base + n;
+            iov[next].iov_len -= n;
+        }
     }
-    if (words.size() > 0 && words.back() == "\n") {
-        words.pop_back();
+    return true;
+}
+
+// Function to answer a STREAM request: the replies for offset, offset + k, ... up to the
+// one ending in EOF, gathered IOV_MAX buffers at a time. The socket is blocking, so each
+// writev waits for the client to make room and the client's reading paces the stream.
+void send_stream(int client_fd, const Corpus& words, int offset, int k, int p) {
+    vector<iovec> iov;
+    while ((size_t)offset < words.size()) {
+        iov.clear();
+        while ((size_t)offset < words.size() && iov.size() < IOV_MAX) {
+            gather_response(iov, words, offset, k, p);
+            offset += k;
+        }
+        if (!send_iovecs(client_fd, iov)) {
+            return;
+        }
     }
-    return words;
 }
 
 int main() {
+    // A client that resets its connection mid-reply must not kill the server: with
+    // SIGPIPE ignored, send, writev and sendfile fail with EPIPE and only that client ends
+    signal(SIGPIPE, SIG_IGN);
+
     // Load config from config.json using json
     json config;
     ifstream config_file("config.json", ifstream::binary);
     if (!config_file.is_open()) {
-        cerr << "Error: Unable to open config.json" << endl;
+        LOG(LOG_ERROR) << "Error: Unable to open config.json";
         return 1;
     }
     config_file >> config;
@@ -48,21 +106,32 @@ int main() {
     int k = config["k"].get<int>();
     int num_clients = config["num_clients"].get<int>();
 
+    // Request lines and echoed replies are only logged at "debug"
+    string log_level = config.value("log_level", "info");
+    LogLevel level;
+    if (!Logger::parse_level(log_level, level)) {
+        LOG(LOG_ERROR) << "Error: Unknown log_level " << log_level << " (use error, warn, info or debug)";
+        return 1;
+    }
+    Logger::set_level(level);
+
     // Log server configuration
-    cout << "Starting server on IP " << server_ip << " and port " << port << endl;
-    cout << "Serving file: " << filename << endl;
-    cout << "Config: k = " << k << ", p = " << p << endl;
-
-    // Read the file and split it into words
-    ifstream file(filename);
-    if (!file.is_open()) {
-        cerr << "Error: Unable to open file " << filename << endl;
+    LOG(LOG_INFO) << "Starting server on IP " << server_ip << " and port " << port;
+    LOG(LOG_INFO) << "Serving file: " << filename;
+    LOG(LOG_INFO) << "Config: k = " << k << ", p = " << p;
+
+    // Map the file and index its words
+    Corpus words;
+    if (!words.load(filename)) {
+        LOG(LOG_ERROR) << "Error: Unable to open file " << filename;
         return 1;
     }
+    LOG(LOG_INFO) << "File read successfully, total words: " << words.size();
 
-    string file_content((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
-    vector<string> words = split_words(file_content);
-    cout << "File read successfully, total words: " << words.size() << endl;
+    // Count the whole file once, in parallel, so a FREQ request for it is a single send
+    int frequency_threads = max(1u, thread::hardware_concurrency());
+    string frequencies = frequency_reply(count_words(words, 0, words.size(), frequency_threads));
+    LOG(LOG_INFO) << "Word frequencies counted: " << frequencies.size() << " bytes";
 
     // Setup TCP socket
     int server_fd, client_fd;
@@ -71,7 +140,7 @@ int main() {
     // Create socket
     server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd < 0) {
-        cerr << "Error: Socket creation failed" << endl;
+        LOG(LOG_ERROR) << "Error: Socket creation failed";
         return 1;
     }
 
@@ -81,79 +150,97 @@ int main() {
 
     // Bind socket
     if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        cerr << "Error: Binding failed" << endl;
+        LOG(LOG_ERROR) << "Error: Binding failed";
         close(server_fd);
         return 1;
     }
 
     // Start listening
     if (listen(server_fd, 10) < 0) {
-        cerr << "Error: Listening failed" << endl;
+        LOG(LOG_ERROR) << "Error: Listening failed";
         close(server_fd);
         return 1;
     }
-    cout << "Server is listening on " << server_ip << ":" << port << endl;
+    LOG(LOG_INFO) << "Server is listening on " << server_ip << ":" << port;
 
     // Accept multiple clients (based on num_clients in config)
     while (true) {
         client_fd = accept(server_fd, NULL, NULL);
         if (client_fd < 0) {
-            cerr << "Error: Accept failed" << endl;
+            LOG(LOG_ERROR) << "Error: Accept failed";
             continue;
         }
-        cout << "Client connected" << endl;
+        LOG(LOG_DEBUG) << "Client connected";
 
         char buffer[BUFFER_SIZE];
+        vector<iovec> iov;
         
         // Process client requests
-        int cnt = 0;
         while (recv(client_fd, buffer, BUFFER_SIZE, 0) > 0) {
             buffer[strcspn(buffer, "\n")] = 0; // Remove newline character from the buffer
             string request(buffer);
 
+            // "FREQ [offset [count]]" asks for the word counts of count words from offset,
+            // the whole file by default, instead of the words themselves
+            if (request.compare(0, 4, "FREQ") == 0) {
+                int first = 0, count = 0;
+                istringstream fields(request.substr(4));
+                fields >> first >> count;
+                LOG(LOG_DEBUG) << "Received request for word frequencies from offset: " << first;
+
+                if (first < 0 || first >= words.size()) {
+                    send(client_fd, "$$\n", 3, 0);
+                } else if (first == 0 && (count <= 0 || (size_t)count >= words.size())) {
+                    send(client_fd, frequencies.data(), frequencies.size(), 0);
+                } else {
+                    size_t last = count <= 0 ? words.size() : min<size_t>((size_t)first + count, words.size());
+                    string reply = frequency_reply(count_words(words, first, last, 1));
+                    send(client_fd, reply.data(), reply.size(), 0);
+                }
+                memset(buffer, 0, BUFFER_SIZE);
+                continue;
+            }
+
+            // "STREAM offset" asks for every reply from offset to the end of the file at once
+            bool stream = request.compare(0, 7, "STREAM ") == 0;
+            if (stream) {
+                request.erase(0, 7);
+            }
+
             // Attempt to convert request to an integer (offset)
             int offset = stoi(request);
 
-            cout << "Received request for offset: " << offset << endl;
+            LOG(LOG_DEBUG) << "Received request for offset: " << offset;
 
             // Check if offset is within bounds
             if (offset >= words.size()) {
-                cout << "Offset " << offset << " exceeds file size. Sending $$." << endl;
+                LOG(LOG_DEBUG) << "Offset " << offset << " exceeds file size. Sending $$.";
                 send(client_fd, "$$\n", 3, 0);
             } 
+            else if (stream) {
+                LOG(LOG_DEBUG) << "Streaming from offset " << offset << " to the end of the file";
+                send_stream(client_fd, words, offset, k, p);
+            }
             else {
-                string response = "";
-                int count = 0;
-
-                for (int i = offset; i < offset + k && i < words.size(); i++) {
-                    response += words[i] + ",";
-                    count++;
-                    cnt ++;
-                    if (count >= p) {
-                        if (i + 1 >= words.size()) {
-                            response += "EOF";
-                        }
-                        response += "\n";
-                        send(client_fd, response.c_str(), response.size(), 0);
-                        count = 0; // Reset count
-                        cout<<response;
-                        response = "";
+                // Gather the whole reply and send it in one go, whatever p is
+                iov.clear();
+                gather_response(iov, words, offset, k, p);
+                if (Logger::enabled(LOG_DEBUG)) {
+                    string reply;
+                    for (const iovec& part : iov) {
+                        reply.append((const char*)part.iov_base, part.iov_len);
                     }
+                    reply.pop_back();  // The logger ends the line itself
+                    LOG(LOG_DEBUG) << reply;
                 }
-                if (count > 0){
-                    if (cnt + 1 >=  words.size()) response += "EOF";
-                    response += "\n";
-                    cout<<cnt<<endl;
-                    cout<<response;
-                    send(client_fd, response.c_str(), response.size(), 0);
-                }
+                send_iovecs(client_fd, iov);
             }
 
             // Clear the buffer for the next iteration
             memset(buffer, 0, BUFFER_SIZE);  // Clear buffer
         }
 
-        cout << "Client disconnected" << endl;
+        LOG(LOG_DEBUG) << "Client disconnected";
         close(client_fd);
     }
 
@@ -0,0 +1,104 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include "corpus.hpp"
+#include "text_reply.hpp"
+#include "compression.hpp"
+
+// Benchmark for compressed replies: for each k, the text reply of every aligned offset
+// of a word file (p = 2, byte for byte what the server sends) is compressed into its own
+// frame and decompressed again, as a compressed connection or the compressed cache would.
+// It reports the bytes per word on the wire with and without compression, the CPU cost
+// of each direction, and the words per second a client could get over a link of the
+// given speed (100 Mbit/s by default) sending the plain replies, compressing each reply
+// when it is sent, or sending frames compressed once at startup.
+//
+//   ./bench_compress [file [link Mbit/s]]
+
+#define P 2
+#define MIN_SECONDS 0.5  // Every pass is repeated until it has run this long
+
+using namespace std;
+
+// Function to time pass, repeated until it has run MIN_SECONDS; returns seconds per run
+template <typename Pass>
+double time_pass(Pass pass) {
+    int runs = 0;
+    auto start = chrono::steady_clock::now();
+    double elapsed;
+    do {
+        pass();
+        runs++;
+        elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    } while (elapsed < MIN_SECONDS);
+    return elapsed / runs;
+}
+
+int main(int argc, char* argv[]) {
+    string filename = argc > 1 ? argv[1] : "words.txt";
+    double link_mbit = argc > 2 ? stod(argv[2]) : 100;
+    double link_bytes = link_mbit * 1e6 / 8;
+
+    Corpus words;
+    if (!words.load(filename)) {
+        cerr << "Error: Unable to open file " << filename << endl;
+        return 1;
+    }
+    cout << filename << ": " << words.size() << " words, link " << link_mbit << " Mbit/s" << endl;
+    cout << setw(8) << "k" << setw(10) << "raw B/w" << setw(10) << "lz B/w" << setw(8) << "ratio"
+         << setw(12) << "comp MB/s" << setw(12) << "decomp MB/s" << setw(10) << "ns/word"
+         << setw(12) << "raw Mw/s" << setw(12) << "lz Mw/s" << setw(14) << "cached Mw/s" << endl;
+
+    for (size_t k : {10, 100, 1000, 10000, 100000}) {
+        vector<string> replies;
+        size_t raw = 0;
+        for (size_t offset = 0; offset < words.size(); offset += k) {
+            replies.emplace_back();
+            append_response(replies.back(), words, offset, k, P);
+            raw += replies.back().size();
+        }
+
+        string frames;
+        double compress = time_pass([&]() {
+            frames.clear();
+            for (const string& reply : replies) {
+                append_compressed_frame(frames, reply.data(), reply.size());
+            }
+        });
+
+        string reply;
+        bool same = true;
+        double decompress = time_pass([&]() {
+            string_view rest(frames);
+            size_t frame_length, i = 0;
+            while (take_compressed_frame(rest, reply, frame_length) && frame_length > 0) {
+                same = same && reply == replies[i++];
+                rest.remove_prefix(frame_length);
+            }
+            same = same && rest.empty() && i == replies.size();
+        });
+        if (!same) {
+            cerr << "Error: Decompressed replies differ for k = " << k << endl;
+            return 1;
+        }
+
+        // Each rate is the slowest of the link and the CPU work that cannot overlap it
+        double n = words.size();
+        double raw_rate = link_bytes / (raw / n);
+        double wire_rate = link_bytes / (frames.size() / n);
+        double lz_rate = min({wire_rate, n / compress, n / decompress});
+        double cached_rate = min(wire_rate, n / decompress);
+
+        cout << setw(8) << k << fixed << setprecision(2)
+             << setw(10) << raw / n << setw(10) << frames.size() / n
+             << setw(8) << setprecision(1) << (double)raw / frames.size()
+             << setw(12) << setprecision(0) << raw / compress / 1e6 << setw(12) << raw / decompress / 1e6
+             << setw(10) << setprecision(1) << compress / n * 1e9
+             << setw(12) << setprecision(2) << raw_rate / 1e6 << setw(12) << lz_rate / 1e6
+             << setw(14) << cached_rate / 1e6 << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include "word_table.hpp"
+#include "reply_tokenizer.hpp"
+
+// Microbenchmark for the clients' word counting: the std::map<string, int> they used to
+// fill against WordTable, both fed by the clients' tokenizer from a stream of server
+// replies (words.txt, p words per line, repeated up to the requested size, 1 GB by
+// default) taken BUFFER_SIZE bytes at a time as recv would hand it over. An optional
+// second argument switches to that many distinct synthetic words. The tokenizers are
+// compared the same way, all counting into a WordTable: the istringstream/getline/
+// remove_if pass the clients ran over each response, the byte loop that built a string
+// per token, and ReplyTokenizer scanning each buffer in place.
+
+#define BUFFER_SIZE 4096
+
+using namespace std;
+
+// Function to build size bytes of reply stream, lines of p words. The words are those of
+// words.txt, or when vocabulary is not 0 a pseudo-random sequence drawn from that many
+// distinct ones, to see how the tables cope with more than the few words.txt holds.
+bool make_stream(size_t size, int p, size_t vocabulary, string& stream) {
+    string words;
+    if (vocabulary == 0) {
+        ifstream in("words.txt");
+        if (!in.is_open()) {
+            cerr << "Error: Unable to open words.txt" << endl;
+            return false;
+        }
+        words.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    } else {
+        uint64_t state = 1;
+        while (words.size() < (64 << 20)) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            words += "word" + to_string((state >> 33) % vocabulary) + ",";
+        }
+    }
+
+    string lines;
+    int in_line = 0;
+    for (char c : words) {
+        if (c == '\n') {
+            continue;
+        }
+        lines += c;
+        if (c == ',' && ++in_line == p) {
+            lines += '\n';
+            in_line = 0;
+        }
+    }
+
+    stream.reserve(size + lines.size());
+    while (stream.size() < size) {
+        stream += lines;
+    }
+    return true;
+}
+
+// Function to run the clients' tokenizer over stream, handing every word to count
+template <typename Counter>
+double tokenize(const string& stream, Counter count) {
+    auto start = chrono::steady_clock::now();
+    string token;
+    for (size_t pos = 0; pos < stream.size(); pos += BUFFER_SIZE) {
+        size_t end = min(stream.size(), pos + BUFFER_SIZE);
+        for (size_t i = pos; i < end; i++) {
+            char c = stream[i];
+            if (c == ',') {
+                if (!token.empty()) {
+                    count(token);
+                    token.clear();
+                }
+            } else if (!isspace((unsigned char)c)) {
+                token += c;
+            }
+        }
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Function to split stream the way the clients used to split a response, with getline
+// and remove_if on each token
+template <typename Counter>
+double tokenize_getline(const string& stream, Counter count) {
+    auto start = chrono::steady_clock::now();
+    for (size_t pos = 0; pos < stream.size(); pos += BUFFER_SIZE) {
+        istringstream response(stream.substr(pos, BUFFER_SIZE));
+        string word;
+        while (getline(response, word, ',')) {
+            word.erase(remove_if(word.begin(), word.end(), ::isspace), word.end());
+            if (!word.empty()) {
+                count(word);
+            }
+        }
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Function to split stream with ReplyTokenizer, BUFFER_SIZE bytes per feed
+template <typename Counter>
+double tokenize_in_place(const string& stream, Counter count) {
+    auto start = chrono::steady_clock::now();
+    ReplyTokenizer tokenizer;
+    for (size_t pos = 0; pos < stream.size(); pos += BUFFER_SIZE) {
+        size_t length = min<size_t>(BUFFER_SIZE, stream.size() - pos);
+        tokenizer.feed(stream.data() + pos, length, count, [](string_view) {});
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void report(const string& name, double seconds, size_t bytes, uint64_t words, size_t distinct) {
+    cout << setw(28) << left << name << fixed << setprecision(3)
+         << setw(10) << right << seconds << " s "
+         << setw(10) << setprecision(1) << words / seconds / 1e6 << " M counts/s "
+         << setw(8) << setprecision(3) << bytes / seconds / (1 << 30) << " GB/s "
+         << setw(10) << distinct << " distinct" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    size_t size_mb = argc > 1 ? stoul(argv[1]) : 1024;
+    size_t vocabulary = argc > 2 ? stoul(argv[2]) : 0;
+
+    cout << "Generating " << size_mb << " MB reply stream..." << endl;
+    string stream;
+    if (!make_stream(size_mb << 20, 2, vocabulary, stream)) {
+        return 1;
+    }
+
+    map<string, int> word_map;
+    uint64_t map_words = 0;
+    double seconds = tokenize(stream, [&](const string& word) {
+        word_map[word]++;
+        map_words++;
+    });
+    report("std::map<string, int>", seconds, stream.size(), map_words, word_map.size());
+
+    WordTable table;
+    uint64_t table_words = 0;
+    seconds = tokenize(stream, [&](const string& word) {
+        table.add(word);
+        table_words++;
+    });
+    report("WordTable", seconds, stream.size(), table_words, table.size());
+
+    // The getline pass splits words that straddle two buffers, so its counts are off
+    WordTable getline_table;
+    uint64_t getline_words = 0;
+    seconds = tokenize_getline(stream, [&](const string& word) {
+        getline_table.add(word);
+        getline_words++;
+    });
+    report("getline + WordTable", seconds, stream.size(), getline_words, getline_table.size());
+
+    WordTable in_place_table;
+    uint64_t in_place_words = 0;
+    seconds = tokenize_in_place(stream, [&](string_view word) {
+        in_place_table.add(word);
+        in_place_words++;
+    });
+    report("ReplyTokenizer + WordTable", seconds, stream.size(), in_place_words, in_place_table.size());
+
+    // The byte loop and ReplyTokenizer must agree with std::map word for word
+    if (in_place_table.sorted() != table.sorted()) {
+        cerr << "Error: ReplyTokenizer and the byte loop counts differ" << endl;
+        return 1;
+    }
+    auto entries = table.sorted();
+    bool same = entries.size() == word_map.size();
+    auto it = word_map.begin();
+    for (size_t i = 0; same && i < entries.size(); i++, ++it) {
+        same = entries[i].first == it->first && entries[i].second == (uint64_t)it->second;
+    }
+    if (!same) {
+        cerr << "Error: WordTable and std::map counts differ" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <iomanip>
+#include "corpus.hpp"
+
+// Microbenchmark for corpus tokenisation: the old split_words (find + substr per word)
+// against the scalar, SSE2 and AVX2 comma scanners and a full Corpus::load, on the
+// shipped words.txt repeated up to the requested size (1 GB by default).
+
+#define SLICE_SIZE (64 << 20)
+
+using namespace std;
+
+const string BIG_FILE = "words_big.txt";
+
+// The tokenizer the servers used before the corpus index
+vector<string> split_words(const string &str) {
+    vector<string> words;
+    size_t start = 0, end = 0;
+    while ((end = str.find(',', start)) != string::npos) {
+        words.push_back(str.substr(start, end - start));
+        start = end + 1;
+    }
+    if (start < str.size()) {
+        words.push_back(str.substr(start));
+    }
+    if (!words.empty() && words.back() == "\n") {
+        words.pop_back();
+    }
+    return words;
+}
+
+// Function to write words.txt repeatedly until the file reaches size bytes
+bool make_corpus(size_t size) {
+    ifstream in("words.txt");
+    if (!in.is_open()) {
+        cerr << "Error: Unable to open words.txt" << endl;
+        return false;
+    }
+    string words((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+    ofstream out(BIG_FILE, ios::binary);
+    for (size_t written = 0; written < size; written += words.size()) {
+        out << words;
+    }
+    return out.good();
+}
+
+void report(const string& name, double seconds, size_t bytes, size_t words) {
+    cout << setw(24) << left << name << fixed << setprecision(3)
+         << setw(10) << right << seconds << " s "
+         << setw(10) << bytes / seconds / (1 << 30) << " GB/s "
+         << setw(12) << words << " words" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    size_t size_mb = argc > 1 ? stoul(argv[1]) : 1024;
+
+    cout << "Generating " << size_mb << " MB corpus..." << endl;
+    if (!make_corpus(size_mb << 20)) {
+        return 1;
+    }
+
+    ifstream file(BIG_FILE, ios::binary);
+    string content((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    size_t bytes = content.size();
+
+    // Old path, run over comma-aligned slices so the per-word strings fit in memory
+    auto start = chrono::steady_clock::now();
+    size_t split_count = 0;
+    for (size_t pos = 0; pos < bytes;) {
+        size_t end = min(bytes, pos + SLICE_SIZE);
+        size_t comma = content.rfind(',', end - 1);
+        if (end < bytes && comma != string::npos && comma >= pos) {
+            end = comma + 1;
+        }
+        split_count += split_words(content.substr(pos, end - pos)).size();
+        pos = end;
+    }
+    report("split_words", chrono::duration<double>(chrono::steady_clock::now() - start).count(), bytes, split_count);
+
+    vector<pair<string, CommaScanner>> scanners = {{"scalar", scan_commas_scalar}};
+#if defined(__x86_64__)
+    scanners.push_back({"sse2", scan_commas_sse2});
+    if (__builtin_cpu_supports("avx2")) {
+        scanners.push_back({"avx2", scan_commas_avx2});
+    }
+#endif
+
+    // Each scanner does what Corpus::load does: count, then fill the exact-size index
+    vector<uint64_t> ends;
+    for (auto& scanner : scanners) {
+        start = chrono::steady_clock::now();
+        size_t count = scanner.second(content.data(), bytes, nullptr);
+        ends.resize(count);
+        scanner.second(content.data(), bytes, ends.data());
+        report("scan " + scanner.first, chrono::duration<double>(chrono::steady_clock::now() - start).count(), bytes, count);
+    }
+
+    content.clear();
+    content.shrink_to_fit();
+    ends.clear();
+    ends.shrink_to_fit();
+
+    start = chrono::steady_clock::now();
+    Corpus corpus;
+    if (!corpus.load(BIG_FILE)) {
+        cerr << "Error: Unable to load " << BIG_FILE << endl;
+        return 1;
+    }
+    report("Corpus::load", chrono::duration<double>(chrono::steady_clock::now() - start).count(), bytes, corpus.size());
+
+    return 0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <arpa/inet.h>
+
+// Binary wire protocol, an alternative to the comma text protocol. A client asks for it by
+// sending the line BINARY_HELLO as its first request; a server that supports it answers
+// BINARY_ACK (an older one answers "Invalid offset") and from then on the connection is
+// binary both ways:
+//
+//   request: uint32 offset, uint32 count (0 asks for the server's k)
+//   reply:   uint32 words, uint32 payload bytes, uint32 flags, then for each word a
+//            uint32 length followed by its bytes
+//
+// All integers are big-endian. The payload size in the header lets a reader take a whole
+// reply at once, with no sentinels to search for.
+//
+// A client that sends ID_HELLO instead gets the dictionary-encoded variant: ID_ACK is
+// followed by one reply flagged BINARY_DICTIONARY that lists every distinct word of the
+// file, in the word encoding above, and a word's position in it is its ID. Requests are
+// the same, and each reply's payload is then one uint32 ID per word.
+#define BINARY_HELLO "BINARY\n"
+#define BINARY_ACK "OK BINARY\n"
+#define ID_HELLO "BINARY IDS\n"
+#define ID_ACK "OK BINARY IDS\n"
+#define BINARY_REQUEST_SIZE 8
+#define BINARY_REPLY_SIZE 12
+
+enum BinaryFlags : uint32_t {
+    BINARY_EOF = 1,           // The reply ends at the last word of the file
+    BINARY_OUT_OF_RANGE = 2,  // The offset is past the end of the file (the text protocol's $$)
+    BINARY_DICTIONARY = 4,    // The word list that IDs index into, sent once after ID_ACK
+};
+
+inline void put_u32(char* out, uint32_t value) {
+    value = htonl(value);
+    memcpy(out, &value, 4);
+}
+
+inline uint32_t get_u32(const char* in) {
+    uint32_t value;
+    memcpy(&value, in, 4);
+    return ntohl(value);
+}
@@ -1,14 +1,18 @@
 #include <iostream>
-#include <map>
 #include <string>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include "json.hpp"  // For nlohmann::json
+#include "binary_protocol.hpp"
+#include "compression.hpp"
+#include "word_table.hpp"
+#include "frequency.hpp"
+#include "reply_tokenizer.hpp"
 #include <chrono>
 #include <fstream>
 #include <thread>
-#include <sstream>
+#include <atomic>
 #include <vector>
 #include <algorithm>
 
@@ -29,16 +33,386 @@ json readConfig(const string& filename) {
     return config;
 }
 
-// Function to count and log the number of words received by the client
-void run_client(const string& server_ip, int server_port, int k, int p, int client_id) {
+// Function to fetch the whole file with up to window offset requests in flight on sock,
+// counting every word into word_count. Each request asks for count words, which the
+// server must allow (see max_count in the server); when count is the server's k the
+// plain "offset" request is sent. Offsets are claimed from next_offset, which other
+// connections fetching the same file may share. Replies arrive in request order, so the
+// oldest request in flight is complete once count words, or a sentinel, have come back
+// for it. Returns false if the server caps count below what was asked (its reply then
+// ends with CAPPED), or if the connection fails before every reply has been received.
+bool fetch_pipelined(int sock, int k, int count, int window, int client_id, WordTable& word_count, atomic<int>& next_offset) {
+    char buffer[BUFFER_SIZE];
+    int in_flight = 0;        // Requests sent whose reply is not yet complete
+    int reply_words = 0;      // Words received so far for the oldest request in flight
+    int capped_at = 0;        // Words in a reply the server capped, once one arrives
+    bool done = false;        // EOF or $$ seen: every later reply is $$, so stop requesting
+    ReplyTokenizer tokenizer;
+    string requests;
+
+    while (true) {
+        // Top the window up with a single send
+        requests.clear();
+        while (!done && in_flight < window) {
+            requests += to_string(next_offset.fetch_add(count));
+            if (count != k) {
+                requests += " " + to_string(count);
+            }
+            requests += "\n";
+            in_flight++;
+        }
+        if (!requests.empty() && send(sock, requests.data(), requests.size(), 0) < 0) {
+            return false;
+        }
+        if (in_flight == 0) {
+            return true;
+        }
+
+        ssize_t len = recv(sock, buffer, BUFFER_SIZE, 0);
+        if (len <= 0) {
+            cerr << "[CLIENT " << client_id << "] Connection closed with " << in_flight << " requests in flight" << endl;
+            return false;
+        }
+
+        tokenizer.feed(buffer, len, [&](string_view word) {
+            word_count.add(word);
+            if (++reply_words == count) {
+                in_flight--;
+                reply_words = 0;
+            }
+        }, [&](string_view token) {
+            // EOF follows the last words of a reply; when that reply was a full k words
+            // it has already been completed. $$ is a reply on its own.
+            if (token == "EOF" || token == "$$") {
+                if (token == "$$" || reply_words > 0) {
+                    in_flight--;
+                    reply_words = 0;
+                }
+                done = true;
+            } else if (token == "CAPPED" && capped_at == 0) {
+                capped_at = reply_words;
+            }
+        });
+        if (capped_at > 0) {
+            // The next request already in flight starts after the words we didn't get
+            cerr << "[CLIENT " << client_id << "] Server capped a request at " << capped_at
+                 << " words; lower request_count" << endl;
+            return false;
+        }
+    }
+}
+
+// Function to fetch the whole file with a single STREAM request, counting every word into
+// word_count. The server answers with every reply from offset 0 on, count words each,
+// and paces itself to how fast they are read, so the only round trip is the first one.
+// The replies are parsed as they arrive until the EOF (or $$) that ends the stream.
+// Returns false if the connection fails first.
+bool fetch_stream(int sock, int k, int count, int client_id, WordTable& word_count) {
+    char buffer[BUFFER_SIZE];
+    ReplyTokenizer tokenizer;
+
+    string request = "STREAM 0";
+    if (count != k) {
+        request += " " + to_string(count);
+    }
+    request += "\n";
+    if (send(sock, request.data(), request.size(), 0) < 0) {
+        return false;
+    }
+
+    while (true) {
+        ssize_t len = recv(sock, buffer, BUFFER_SIZE, 0);
+        if (len <= 0) {
+            cerr << "[CLIENT " << client_id << "] Connection closed before the end of the stream" << endl;
+            return false;
+        }
+
+        bool finished = false;
+        tokenizer.feed(buffer, len, [&](string_view word) {
+            word_count.add(word);
+        }, [&](string_view token) {
+            finished = finished || token == "EOF" || token == "$$";
+        });
+        if (finished) {
+            return true;
+        }
+    }
+}
+
+// Function to negotiate compressed replies and fetch the whole file with up to window
+// offset requests in flight, claiming offsets from next_offset like fetch_pipelined. Every
+// reply arrives as one frame, so a request is complete when its frame is, and its words
+// are counted once the frame is decompressed.
+// Returns false if the server refuses compression, caps count below what was asked (a
+// frame short of count words without EOF or $$), or the connection fails.
+bool fetch_compressed(int sock, int k, int count, int window, int client_id, WordTable& word_count, atomic<int>& next_offset) {
+    char buffer[BUFFER_SIZE];
+    string pending;          // Received bytes not yet consumed as whole frames
+    string reply;            // The decompressed reply of the current frame
+
+    // The server answers the hello with one line and nothing else until the next request
+    send(sock, COMPRESS_HELLO, strlen(COMPRESS_HELLO), 0);
+    size_t newline;
+    while ((newline = pending.find('\n')) == string::npos) {
+        ssize_t len = recv(sock, buffer, BUFFER_SIZE, 0);
+        if (len <= 0) {
+            return false;
+        }
+        pending.append(buffer, len);
+    }
+    if (pending.compare(0, newline + 1, COMPRESS_ACK) != 0) {
+        cerr << "[CLIENT " << client_id << "] Server does not support compressed replies" << endl;
+        return false;
+    }
+    pending.erase(0, newline + 1);
+
+    int in_flight = 0;
+    bool done = false;       // EOF or $$ seen: every later reply is $$, so stop requesting
+    ReplyTokenizer tokenizer;
+    string requests;
+
+    while (true) {
+        // Top the window up with a single send
+        requests.clear();
+        while (!done && in_flight < window) {
+            requests += to_string(next_offset.fetch_add(count));
+            if (count != k) {
+                requests += " " + to_string(count);
+            }
+            requests += "\n";
+            in_flight++;
+        }
+        if (!requests.empty() && send(sock, requests.data(), requests.size(), 0) < 0) {
+            return false;
+        }
+        if (in_flight == 0) {
+            return true;
+        }
+
+        ssize_t len = recv(sock, buffer, BUFFER_SIZE, 0);
+        if (len <= 0) {
+            cerr << "[CLIENT " << client_id << "] Connection closed with " << in_flight << " requests in flight" << endl;
+            return false;
+        }
+        pending.append(buffer, len);
+
+        // Count the words of every complete frame
+        size_t start = 0, frame_length;
+        while (take_compressed_frame(string_view(pending).substr(start), reply, frame_length)) {
+            if (frame_length == 0) {
+                cerr << "[CLIENT " << client_id << "] Received a malformed compressed reply" << endl;
+                return false;
+            }
+            int words = 0;
+            bool last = false;   // This frame ends the file (EOF) or is past it ($$)
+            tokenizer.feed(reply.data(), reply.size(), [&](string_view word) {
+                word_count.add(word);
+                words++;
+            }, [&](string_view token) {
+                last = last || token == "EOF" || token == "$$";
+            });
+            start += frame_length;
+            in_flight--;
+            if (last) {
+                done = true;
+            } else if (words < count) {
+                // The next request already in flight starts after the words we didn't get
+                cerr << "[CLIENT " << client_id << "] Server capped a request at " << words
+                     << " words; lower request_count" << endl;
+                return false;
+            }
+        }
+        pending.erase(0, start);
+    }
+}
+
+// Function to ask the server for the word counts of the whole file with one FREQ request
+// instead of downloading its words. The reply header gives the body size, so the body is
+// read whole and each "word, count" line added to word_count. Returns false if the server
+// refuses the request or the connection fails first.
+bool fetch_frequencies(int sock, int client_id, WordTable& word_count) {
+    char buffer[BUFFER_SIZE];
+    if (send(sock, "FREQ\n", 5, 0) < 0) {
+        return false;
+    }
+
+    string reply;
+    size_t header_end = string::npos, distinct = 0, bytes = 0;
+    while (header_end == string::npos || reply.size() < header_end + 1 + bytes) {
+        ssize_t len = recv(sock, buffer, BUFFER_SIZE, 0);
+        if (len <= 0) {
+            cerr << "[CLIENT " << client_id << "] Connection closed before the word frequencies arrived" << endl;
+            return false;
+        }
+        reply.append(buffer, len);
+
+        if (header_end == string::npos && (header_end = reply.find('\n')) != string::npos) {
+            if (!parse_frequency_header(reply.substr(0, header_end), distinct, bytes)) {
+                cerr << "[CLIENT " << client_id << "] Server refused the frequency request: " << reply.substr(0, header_end) << endl;
+                return false;
+            }
+            reply.reserve(header_end + 1 + bytes);
+        }
+    }
+
+    string_view body(reply.data() + header_end + 1, bytes);
+    while (!body.empty()) {
+        size_t newline = body.find('\n');
+        string_view word;
+        uint64_t times;
+        if (parse_frequency_line(body.substr(0, newline), word, times)) {
+            word_count.add(word, times);
+        }
+        body.remove_prefix(newline == string_view::npos ? body.size() : newline + 1);
+    }
+    return true;
+}
+
+// Function to negotiate the binary protocol and fetch the whole file with it, up to window
+// requests in flight, claiming offsets from next_offset like fetch_pipelined. Every reply
+// starts with a header giving its size, so replies are taken whole and their words
+// counted without looking for sentinels. With ids set the dictionary-encoded
+// variant is negotiated instead: the server sends every distinct word once, replies carry
+// only word IDs, and those are counted in a flat array indexed by ID whose totals are
+// added to word_count at the end.
+// Returns false if the server refuses the protocol, caps count below what was asked, or
+// the connection fails.
+bool fetch_binary(int sock, int count, int window, bool ids, int client_id, WordTable& word_count, atomic<int>& next_offset) {
+    char buffer[BUFFER_SIZE];
+    string pending;                // Received bytes not yet consumed as whole replies
+    vector<string> dictionary;     // Word of each ID, when ids is set
+    vector<uint64_t> id_counts;    // Occurrences of each ID so far
+    string scratch;                // Room for a word normalize_word strips whitespace from
+
+    // Function to hand the ID counts over to word_count, whatever the outcome
+    auto finish = [&](bool ok) {
+        for (size_t id = 0; id < id_counts.size(); id++) {
+            if (id_counts[id] > 0 && !dictionary[id].empty()) {
+                word_count.add(dictionary[id], id_counts[id]);
+            }
+        }
+        return ok;
+    };
+
+    // The server answers the hello with one line, then the dictionary if ids is set, and
+    // nothing else until the next request
+    const char* hello = ids ? ID_HELLO : BINARY_HELLO;
+    const char* ack = ids ? ID_ACK : BINARY_ACK;
+    send(sock, hello, strlen(hello), 0);
+    size_t newline;
+    while ((newline = pending.find('\n')) == string::npos) {
+        ssize_t len = recv(sock, buffer, BUFFER_SIZE, 0);
+        if (len <= 0) {
+            return false;
+        }
+        pending.append(buffer, len);
+    }
+    if (pending.compare(0, newline + 1, ack) != 0) {
+        cerr << "[CLIENT " << client_id << "] Server does not support the " << (ids ? "ID" : "binary") << " protocol" << endl;
+        return false;
+    }
+    pending.erase(0, newline + 1);
+
+    if (ids) {
+        while (pending.size() < BINARY_REPLY_SIZE || pending.size() - BINARY_REPLY_SIZE < get_u32(pending.data() + 4)) {
+            ssize_t len = recv(sock, buffer, BUFFER_SIZE, 0);
+            if (len <= 0) {
+                return false;
+            }
+            pending.append(buffer, len);
+        }
+        uint32_t words = get_u32(pending.data()), bytes = get_u32(pending.data() + 4);
+        const char* word = pending.data() + BINARY_REPLY_SIZE;
+        for (uint32_t i = 0; i < words; i++) {
+            uint32_t length = get_u32(word);
+            dictionary.emplace_back(word + 4, length);
+            word += 4 + length;
+        }
+        id_counts.assign(words, 0);
+        pending.erase(0, BINARY_REPLY_SIZE + bytes);
+    }
+
+    int in_flight = 0;
+    bool done = false;       // EOF or out of range seen: stop requesting, drain the rest
+    string requests;
+
+    while (true) {
+        requests.clear();
+        while (!done && in_flight < window) {
+            char frame[BINARY_REQUEST_SIZE];
+            put_u32(frame, next_offset.fetch_add(count));
+            put_u32(frame + 4, count);
+            requests.append(frame, BINARY_REQUEST_SIZE);
+            in_flight++;
+        }
+        if (!requests.empty() && send(sock, requests.data(), requests.size(), 0) < 0) {
+            return finish(false);
+        }
+        if (in_flight == 0) {
+            return finish(true);
+        }
+
+        ssize_t len = recv(sock, buffer, BUFFER_SIZE, 0);
+        if (len <= 0) {
+            cerr << "[CLIENT " << client_id << "] Connection closed with " << in_flight << " requests in flight" << endl;
+            return finish(false);
+        }
+        pending.append(buffer, len);
+
+        // Consume every complete reply
+        size_t start = 0;
+        while (pending.size() - start >= BINARY_REPLY_SIZE) {
+            const char* header = pending.data() + start;
+            uint32_t words = get_u32(header), bytes = get_u32(header + 4), flags = get_u32(header + 8);
+            if (pending.size() - start - BINARY_REPLY_SIZE < bytes) {
+                break;
+            }
+
+            const char* word = header + BINARY_REPLY_SIZE;
+            if (ids) {
+                for (uint32_t i = 0; i < words; i++, word += 4) {
+                    uint32_t id = get_u32(word);
+                    if (id < id_counts.size()) {
+                        id_counts[id]++;
+                    }
+                }
+            } else {
+                // Words arrive as they are in the file, so whitespace is dropped the
+                // way the text clients, FREQ and the ID dictionary drop it
+                for (uint32_t i = 0; i < words; i++) {
+                    uint32_t length = get_u32(word);
+                    string_view normalized = normalize_word(string_view(word + 4, length), scratch);
+                    if (!normalized.empty()) {
+                        word_count.add(normalized);
+                    }
+                    word += 4 + length;
+                }
+            }
+
+            start += BINARY_REPLY_SIZE + bytes;
+            in_flight--;
+            if (flags & (BINARY_EOF | BINARY_OUT_OF_RANGE)) {
+                done = true;
+            } else if (words < (uint32_t)count) {
+                // The next request already in flight starts after the words we didn't get
+                cerr << "[CLIENT " << client_id << "] Server capped a request at " << words
+                     << " words; lower request_count" << endl;
+                return finish(false);
+            }
+        }
+        pending.erase(0, start);
+    }
+}
+
+// Function to open a TCP connection to the server; returns the socket, or -1 on failure
+int connect_to_server(const string& server_ip, int server_port, int client_id) {
     // Create TCP socket
     int sock = 0;
     struct sockaddr_in serv_addr;
-    char buffer[BUFFER_SIZE] = {0};
 
     if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         cerr << "[CLIENT " << client_id << "] Socket creation error" << endl;
-        return;
+        return -1;
     }
 
     serv_addr.sin_family = AF_INET;
@@ -47,94 +421,178 @@ void run_client(const string& server_ip, int server_port, int k, int p, int clie
     // Convert IPv4 and IPv6 addresses from text to binary form
     if (inet_pton(AF_INET, server_ip.c_str(), &serv_addr.sin_addr) <= 0) {
         cerr << "[CLIENT " << client_id << "] Invalid address/Address not supported" << endl;
-        return;
+        close(sock);
+        return -1;
     }
 
     // Connect to server
     if (connect(sock, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
         cerr << "[CLIENT " << client_id << "] Connection Failed" << endl;
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Function to fetch the whole file over sock and connections - 1 more connections at once,
+// one thread each. They share a single next-offset counter, so every connection takes
+// the next unclaimed offset whenever its window has room and a faster connection simply
+// takes more of the file. Each one counts into its own table, so the threads never
+// contend on a shared one, and the tables are merged into word_count once all are done.
+// Returns false if any connection failed, in which case some words are missing.
+bool fetch_parallel(int sock, const string& server_ip, int server_port, int k, int count, int window, bool binary,
+                    bool ids, bool compressed, int connections, int client_id, WordTable& word_count) {
+    atomic<int> next_offset(0);
+    vector<WordTable> tables(connections);
+    vector<char> succeeded(connections, false);
+    vector<thread> threads;
+
+    for (int i = 0; i < connections; i++) {
+        threads.push_back(thread([&, i]() {
+            int fd = i == 0 ? sock : connect_to_server(server_ip, server_port, client_id);
+            if (fd < 0) {
+                return;
+            }
+            if (binary) {
+                succeeded[i] = fetch_binary(fd, count, window, ids, client_id, tables[i], next_offset);
+            } else if (compressed) {
+                succeeded[i] = fetch_compressed(fd, k, count, window, client_id, tables[i], next_offset);
+            } else {
+                succeeded[i] = fetch_pipelined(fd, k, count, window, client_id, tables[i], next_offset);
+            }
+            if (i != 0) {
+                close(fd);
+            }
+        }));
+    }
+
+    bool ok = true;
+    for (int i = 0; i < connections; i++) {
+        threads[i].join();
+        word_count.merge(tables[i]);
+        ok = ok && succeeded[i];
+    }
+    return ok;
+}
+
+// Function to log the total number of words in word_count and write it to filename, one
+// "word, count" line per word in sorted order
+void write_word_counts(const WordTable& word_count, const string& filename, const string& tag) {
+    // Sort the counts once, for the total and the output file
+    auto entries = word_count.sorted();
+    uint64_t total_words = 0;
+    for (const auto& entry : entries) {
+        total_words += entry.second;
+    }
+
+    cout << tag << " Total words received: " << total_words << endl;
+
+    ofstream outfile(filename);
+    if (!outfile.is_open()) {
+        cerr << tag << " Error: Unable to open file " << filename << " for writing." << endl;
+    } 
+    else{
+        for (const auto& entry : entries) {
+            outfile << entry.first << ", " << entry.second << "\n";
+        }
+        outfile.close();
+        cout << tag << " Word frequency written to " << filename << endl;
+    }
+}
+
+// Function to count and log the number of words received by the client. With combined
+// set, the counts are moved there instead of written to the client's own file.
+void run_client(const string& server_ip, int server_port, int k, int p, int count, int window, bool binary, bool ids, bool compressed, bool stream,
+                int connections, bool frequencies, int client_id, WordTable* combined) {
+    char buffer[BUFFER_SIZE];
+    int sock = connect_to_server(server_ip, server_port, client_id);
+    if (sock < 0) {
         return;
     }
 
     cout << "[CLIENT " << client_id << "] Connected to server at " << server_ip << ":" << server_port << endl;
 
     int offset = 0;
-    map<string, int> word_count;
+    WordTable word_count;
+    ReplyTokenizer tokenizer;
     bool done = false;
     auto start_time = chrono::high_resolution_clock::now();
 
+    atomic<int> next_offset(0);
+
+    if (frequencies) {
+        fetch_frequencies(sock, client_id, word_count);
+        done = true;
+        cout << "[CLIENT " << client_id << "] Received word frequencies from server." << endl;
+    } else if (stream) {
+        fetch_stream(sock, k, count, client_id, word_count);
+        done = true;
+        cout << "[CLIENT " << client_id << "] Received words from server as one stream." << endl;
+    } else if (connections > 1) {
+        if (!fetch_parallel(sock, server_ip, server_port, k, count, window, binary, ids, compressed, connections, client_id, word_count)) {
+            cerr << "[CLIENT " << client_id << "] A connection failed; the word counts are incomplete" << endl;
+        }
+        done = true;
+        cout << "[CLIENT " << client_id << "] Received words from server over " << connections << " connections." << endl;
+    } else if (binary) {
+        fetch_binary(sock, count, window, ids, client_id, word_count, next_offset);
+        done = true;
+        cout << "[CLIENT " << client_id << "] Received words from server over the " << (ids ? "ID" : "binary") << " protocol." << endl;
+    } else if (compressed) {
+        fetch_compressed(sock, k, count, window, client_id, word_count, next_offset);
+        done = true;
+        cout << "[CLIENT " << client_id << "] Received compressed replies from server." << endl;
+    } else if (window > 1) {
+        fetch_pipelined(sock, k, count, window, client_id, word_count, next_offset);
+        done = true;
+        cout << "[CLIENT " << client_id << "] Received words from server with " << window << " requests in flight." << endl;
+    }
+
     while (!done) {
         // Prepare and send the request
         string request = to_string(offset) + "\n";
         send(sock, request.c_str(), request.size(), 0);
         cout << "[CLIENT " << client_id << "] Sent request for offset: " << offset << endl;
 
-        // Clear buffer and receive data
-        memset(buffer, 0, BUFFER_SIZE);
-        string response = "";
-        
+        // Count the words of each read as it arrives; a word cut off at the end of a read
+        // is finished by the next one
+        bool received = false;
         while (true) {
-            int valread = recv(sock, buffer, BUFFER_SIZE - 1, 0);
+            int valread = recv(sock, buffer, BUFFER_SIZE, 0);
             if (valread <= 0) {
                 // Connection closed or error
                 break;
             }
-            buffer[valread] = '\0';
-            response += string(buffer);
-        
-            // Check if "EOF" or "$$" is in the response
-            if (response.find("EOF\n") != string::npos || response.find("$$\n") != string::npos) {
-                done = true;
-                break;
-            }
+            received = true;
+            tokenizer.feed(buffer, valread, [&](string_view word) {
+                word_count.add(word);
+            }, [&](string_view token) {
+                done = done || token == "EOF" || token == "$$";
+            });
 
-            // If the server sends less than BUFFER_SIZE, assume end of current packet
-            if (valread < BUFFER_SIZE - 1) {
+            // Stop at EOF or $$, or when the server sends less than BUFFER_SIZE, assuming
+            // that is the end of the current reply
+            if (done || valread < BUFFER_SIZE) {
                 break;
             }
         }
 
-        if (response.empty()) {
+        if (!received) {
             cerr << "[CLIENT " << client_id << "] Received an empty response. Terminating." << endl;
             break;
         }
 
-        // Process the response
-        istringstream stream(response);
-        string word;
-        while (getline(stream, word, ',')) {  // Split by commas
-            word.erase(remove_if(word.begin(), word.end(), ::isspace), word.end());  // Trim whitespace
-            if (!word.empty() && word != "EOF" && word != "$$") {  // Exclude EOF and empty words
-                word_count[word]++;
-            }
-        }
-
         cout << "[CLIENT " << client_id << "] Received words from server." << endl;
 
         // Increment the offset by k for the next request
         offset += k;
     }
 
-    // Calculate total number of words received
-    int total_words = 0;
-    for (const auto& entry : word_count) {
-        total_words += entry.second;
-    }
-
-    cout << "[CLIENT " << client_id << "] Total words received: " << total_words << endl;
-
-    // Write word count to a file
-    string filename = "output" + to_string(client_id) + ".txt";
-    ofstream outfile(filename);
-    if (!outfile.is_open()) {
-        cerr << "[CLIENT " << client_id << "] Error: Unable to open file " << filename << " for writing." << endl;
-    } 
-    else{
-        for (const auto& entry : word_count) {
-            outfile << entry.first << ", " << entry.second << endl;
-        }
-        outfile.close();
-        cout << "[CLIENT " << client_id << "] Word frequency written to " << filename << endl;
+    // Hand the counts over for the combined table, or write this client's own file
+    if (combined != nullptr) {
+        *combined = move(word_count);
+    } else {
+        write_word_counts(word_count, "output" + to_string(client_id) + ".txt", "[CLIENT " + to_string(client_id) + "]");
     }
 
     // Close the socket
@@ -150,12 +608,23 @@ int main() {
     int k = config["k"].get<int>();
     int p = config["p"].get<int>();
     int num_clients = config["num_clients"].get<int>();
+    int window = config.value("pipeline_window", 1);  // Offset requests each client keeps in flight
+    bool ids = config.value("id_protocol", false);  // Binary protocol with dictionary-encoded words
+    bool binary = ids || config.value("binary_protocol", false);
+    bool compressed = config.value("compression", false);  // Ask for compressed text replies
+    bool stream = config.value("stream", false);       // Ask for the whole file with one STREAM request
+    int count = config.value("request_count", k);      // Words asked for per request when pipelined, binary or streamed
+    int connections = config.value("connections", 1);  // Connections each client splits the file across
+    bool combine = config.value("combined_output", false);  // One output.txt summing every client's counts
+    bool frequencies = config.value("server_frequencies", false);  // Ask the server for its word counts instead of the words
 
-    // Create threads for each client
+    // Create threads for each client, each counting into a table of its own when combining
     vector<thread> client_threads;
+    vector<WordTable> tables(combine ? num_clients : 0);
 
     for (int i = 0; i < num_clients; ++i) {
-        client_threads.push_back(thread(run_client, server_ip, server_port, k, p, i + 1));
+        WordTable* combined = combine ? &tables[i] : nullptr;
+        client_threads.push_back(thread(run_client, server_ip, server_port, k, p, count, window, binary, ids, compressed, stream, connections, frequencies, i + 1, combined));
     }
 
     // Wait for all client threads to finish
@@ -163,5 +632,12 @@ int main() {
         t.join();
     }
 
+    // The merged table holds the same counts whatever order the clients finished in, and
+    // is written sorted, so the combined file only depends on what was received
+    if (combine && !tables.empty()) {
+        merge_tables(tables);
+        write_word_counts(tables[0], "output.txt", "[CLIENT]");
+    }
+
     return 0;
 }
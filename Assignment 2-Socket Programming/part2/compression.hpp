@@ -0,0 +1,209 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include "binary_protocol.hpp"
+
+// Compressed text replies. A client asks for them by sending the line COMPRESS_HELLO; a
+// server that supports them answers COMPRESS_ACK (an older one answers "Invalid offset"),
+// and from then on every reply it sends, each reply of a stream included, is one frame:
+//
+//   uint32 raw bytes, uint32 payload bytes, then the payload
+//
+// Integers are big-endian like the binary protocol's. The payload is the reply compressed
+// with lz_compress below, or the reply itself when that would not be smaller (payload as
+// long as the raw bytes). Requests stay text lines.
+#define COMPRESS_HELLO "COMPRESS\n"
+#define COMPRESS_ACK "OK COMPRESS\n"
+#define COMPRESS_FRAME_HEADER 8
+
+// A small LZ77 codec in the LZ4 block format: a sequence of (literals, match) pairs,
+// each a token byte whose high nibble is the literal count and low nibble the match
+// length minus LZ_MIN_MATCH (15 meaning more follow in extra bytes, each 255 adding
+// 255 until one is smaller), the literals, then a 2-byte little-endian distance back to
+// the match. The last sequence is literals only. Matches are found through a hash of the
+// next 4 bytes, with no chains, so compression is a single greedy pass; decompression
+// is copies only. The text replies repeat the same few words, so this removes most of
+// their bytes while costing little CPU.
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12     // Largest hash table; small inputs use one about their size
+#define LZ_MAX_DISTANCE 65535
+#define LZ_TAIL 5  // The last bytes of the input are always literals
+
+inline uint32_t lz_read32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+inline uint32_t lz_hash(uint32_t sequence, int bits) {
+    return (sequence * 2654435761u) >> (32 - bits);
+}
+
+// Function to append a length as the extra bytes that follow a saturated token nibble
+inline void lz_put_length(std::string& out, size_t length) {
+    while (length >= 255) {
+        out += (char)255;
+        length -= 255;
+    }
+    out += (char)length;
+}
+
+// Function to append one sequence: literals followed by a match, or literals only when
+// match_length is 0
+inline void lz_put_sequence(std::string& out, const char* literals, size_t literal_length,
+                            size_t distance, size_t match_length) {
+    size_t match_code = match_length == 0 ? 0 : match_length - LZ_MIN_MATCH;
+    out += (char)(((literal_length < 15 ? literal_length : 15) << 4) | (match_code < 15 ? match_code : 15));
+    if (literal_length >= 15) {
+        lz_put_length(out, literal_length - 15);
+    }
+    out.append(literals, literal_length);
+    if (match_length == 0) {
+        return;
+    }
+    out += (char)(distance & 0xff);
+    out += (char)(distance >> 8);
+    if (match_code >= 15) {
+        lz_put_length(out, match_code - 15);
+    }
+}
+
+// Function to compress length bytes of data onto the end of out
+inline void lz_compress(const char* data, size_t length, std::string& out) {
+    // Last position each hash was seen at. A reply of a few words only clears a table
+    // about its own size, which would otherwise cost more than compressing it.
+    int bits = 6;
+    while (bits < LZ_HASH_BITS && ((size_t)1 << bits) < length) {
+        bits++;
+    }
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(uint32_t) << bits);
+    size_t anchor = 0;  // Start of the literals not yet written
+    size_t i = 1;       // Position 0 can only be a literal
+    size_t limit = length > LZ_TAIL + LZ_MIN_MATCH ? length - LZ_TAIL - LZ_MIN_MATCH : 0;
+
+    while (i < limit) {
+        uint32_t sequence = lz_read32(data + i);
+        uint32_t& slot = table[lz_hash(sequence, bits)];
+        size_t candidate = slot;
+        slot = (uint32_t)i;
+        if (i - candidate > LZ_MAX_DISTANCE || lz_read32(data + candidate) != sequence) {
+            i += 1 + ((i - anchor) >> 6);  // Skip faster through data that does not repeat
+            continue;
+        }
+
+        size_t match = LZ_MIN_MATCH;
+        while (i + match < length - LZ_TAIL && data[candidate + match] == data[i + match]) {
+            match++;
+        }
+        lz_put_sequence(out, data + anchor, i - anchor, i - candidate, match);
+        i += match;
+        anchor = i;
+    }
+    lz_put_sequence(out, data + anchor, length - anchor, 0, 0);
+}
+
+// Function to read the extra bytes of a saturated token nibble; false if they run past end
+inline bool lz_get_length(const unsigned char*& in, const unsigned char* end, size_t& length) {
+    unsigned char byte;
+    do {
+        if (in == end) {
+            return false;
+        }
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Function to decompress length bytes of data into exactly raw_length bytes at out; false
+// if the data is malformed or does not decode to that size
+inline bool lz_decompress(const char* data, size_t length, char* out, size_t raw_length) {
+    const unsigned char* in = (const unsigned char*)data;
+    const unsigned char* end = in + length;
+    size_t written = 0;
+
+    while (in < end) {
+        unsigned token = *in++;
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !lz_get_length(in, end, literal_length)) {
+            return false;
+        }
+        if (literal_length > (size_t)(end - in) || literal_length > raw_length - written) {
+            return false;
+        }
+        memcpy(out + written, in, literal_length);
+        in += literal_length;
+        written += literal_length;
+        if (in == end) {
+            break;  // The last sequence has no match
+        }
+
+        if (end - in < 2) {
+            return false;
+        }
+        size_t distance = in[0] | (in[1] << 8);
+        in += 2;
+        size_t match_length = token & 15;
+        if (match_length == 15 && !lz_get_length(in, end, match_length)) {
+            return false;
+        }
+        match_length += LZ_MIN_MATCH;
+        if (distance == 0 || distance > written || match_length > raw_length - written) {
+            return false;
+        }
+        // A match closer than its length overlaps the bytes it produces: copy it byte by byte
+        const char* from = out + written - distance;
+        if (distance >= match_length) {
+            memcpy(out + written, from, match_length);
+        } else {
+            for (size_t j = 0; j < match_length; j++) {
+                out[written + j] = from[j];
+            }
+        }
+        written += match_length;
+    }
+    return written == raw_length;
+}
+
+// Function to append reply as one compressed frame
+inline void append_compressed_frame(std::string& out, const char* reply, size_t length) {
+    size_t header = out.size();
+    out.resize(header + COMPRESS_FRAME_HEADER);
+    lz_compress(reply, length, out);
+    size_t payload = out.size() - header - COMPRESS_FRAME_HEADER;
+    if (payload >= length) {
+        out.resize(header + COMPRESS_FRAME_HEADER);  // Not worth it: store the reply as is
+        out.append(reply, length);
+        payload = length;
+    }
+    put_u32(&out[header], length);
+    put_u32(&out[header + 4], payload);
+}
+
+// Function to take the frame at the start of data if all of it has arrived: its raw
+// reply goes into reply and the frame's size into frame_length. Returns false when more
+// bytes are needed, or with frame_length 0 when the frame is malformed.
+inline bool take_compressed_frame(std::string_view data, std::string& reply, size_t& frame_length) {
+    frame_length = 0;
+    if (data.size() < COMPRESS_FRAME_HEADER) {
+        return false;
+    }
+    uint32_t raw = get_u32(data.data()), payload = get_u32(data.data() + 4);
+    if (data.size() - COMPRESS_FRAME_HEADER < payload) {
+        return false;
+    }
+
+    reply.resize(raw);
+    const char* body = data.data() + COMPRESS_FRAME_HEADER;
+    if (payload == raw) {
+        memcpy(&reply[0], body, raw);
+    } else if (!lz_decompress(body, payload, &reply[0], raw)) {
+        return true;
+    }
+    frame_length = COMPRESS_FRAME_HEADER + payload;
+    return true;
+}
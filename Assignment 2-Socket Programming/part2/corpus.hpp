@@ -0,0 +1,186 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Comma scanners: each one finds every comma in data[0, length), stores its offset
+// in out (unless out is null, which only counts) and returns how many it found.
+// scan_commas picks the widest version the CPU supports the first time it runs.
+typedef size_t (*CommaScanner)(const char* data, size_t length, uint64_t* out);
+
+// Function to scan data[start, length) one byte at a time, continuing from count
+inline size_t scan_commas_tail(const char* data, size_t start, size_t length, uint64_t* out, size_t count) {
+    for (size_t i = start; i < length; i++) {
+        if (data[i] == ',') {
+            if (out != nullptr) {
+                out[count] = i;
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+inline size_t scan_commas_scalar(const char* data, size_t length, uint64_t* out) {
+    return scan_commas_tail(data, 0, length, out, 0);
+}
+
+// Function to append the offsets of the set bits of a comparison mask
+inline size_t emit_mask(uint32_t mask, size_t base, uint64_t* out, size_t count) {
+    if (out == nullptr) {
+        return count + __builtin_popcount(mask);
+    }
+    while (mask != 0) {
+        out[count++] = base + __builtin_ctz(mask);
+        mask &= mask - 1;
+    }
+    return count;
+}
+
+#if defined(__x86_64__)
+inline size_t scan_commas_sse2(const char* data, size_t length, uint64_t* out) {
+    const __m128i comma = _mm_set1_epi8(',');
+    size_t count = 0, i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        count = emit_mask(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, comma)), i, out, count);
+    }
+    return scan_commas_tail(data, i, length, out, count);
+}
+
+// Compiled for AVX2 regardless of the build flags; only called after the CPU check
+__attribute__((target("avx2")))
+inline size_t scan_commas_avx2(const char* data, size_t length, uint64_t* out) {
+    const __m256i comma = _mm256_set1_epi8(',');
+    size_t count = 0, i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+        count = emit_mask(_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, comma)), i, out, count);
+        count = emit_mask(_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, comma)), i + 32, out, count);
+    }
+    return scan_commas_tail(data, i, length, out, count);
+}
+#endif
+
+// Function to choose the scanner for this CPU: AVX2, then SSE2 (always present on x86-64)
+inline CommaScanner best_comma_scanner() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return scan_commas_avx2;
+    }
+    return scan_commas_sse2;
+#else
+    return scan_commas_scalar;
+#endif
+}
+
+inline size_t scan_commas(const char* data, size_t length, uint64_t* out) {
+    static const CommaScanner scanner = best_comma_scanner();
+    return scanner(data, length, out);
+}
+
+// Read-only comma-separated word file. The file is memory-mapped and each word is
+// located through the position of the comma that ends it, so loading is a vectorized
+// scan with no per-word allocation and the index costs 8 bytes per word.
+class Corpus {
+public:
+    Corpus() = default;
+    Corpus(const Corpus&) = delete;
+    Corpus& operator=(const Corpus&) = delete;
+
+    ~Corpus() {
+        if (data != nullptr) {
+            munmap(const_cast<char*>(data), length);
+        }
+    }
+
+    // Function to map the file and index its words; returns false if the file can't be read
+    bool load(const std::string& filename) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            close(fd);
+            return false;
+        }
+
+        length = st.st_size;
+        if (length > 0) {
+            void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                close(fd);
+                length = 0;
+                return false;
+            }
+            data = static_cast<const char*>(mapping);
+            madvise(mapping, length, MADV_SEQUENTIAL);
+        }
+        close(fd);
+
+        index_words();
+        return true;
+    }
+
+    size_t size() const {
+        return ends.size();
+    }
+
+    // Size of the mapped file in bytes
+    size_t bytes() const {
+        return length;
+    }
+
+    std::string_view operator[](size_t i) const {
+        size_t start = i == 0 ? 0 : ends[i - 1] + 1;
+        return std::string_view(data + start, ends[i] - start);
+    }
+
+    // Bytes of words [first, last) exactly as they sit in the file, each followed by its
+    // comma, so a run of words can be sent without building a string. The final comma is
+    // missing when last is the end of a file that doesn't end with one (see comma_after).
+    std::string_view run(size_t first, size_t last) const {
+        size_t start = first == 0 ? 0 : ends[first - 1] + 1;
+        size_t end = comma_after(last - 1) ? ends[last - 1] + 1 : ends[last - 1];
+        return std::string_view(data + start, end - start);
+    }
+
+    bool comma_after(size_t i) const {
+        return ends[i] < length;
+    }
+
+private:
+    // Function to record where every word ends. Words are split on commas exactly like
+    // the old split_words: a non-empty tail after the last comma is a word unless it
+    // is a lone newline.
+    void index_words() {
+        // Count first so the index is allocated once at its exact size, then fill it
+        size_t commas = scan_commas(data, length, nullptr);
+        ends.reserve(commas + 1);
+        ends.resize(commas);
+        scan_commas(data, length, ends.data());
+
+        size_t tail = ends.empty() ? 0 : ends.back() + 1;
+        if (tail < length && std::string_view(data + tail, length - tail) != "\n") {
+            ends.push_back(length);
+        }
+    }
+
+    const char* data = nullptr;
+    size_t length = 0;
+    std::vector<uint64_t> ends;  // Byte offset of the comma (or end of file) after each word
+};
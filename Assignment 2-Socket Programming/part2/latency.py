@@ -0,0 +1,139 @@
+import subprocess
+import socket
+import json
+import time
+import sys
+import statistics
+import threading
+
+# Regression benchmark for connection setup cost: measures the time from connect()
+# to the first byte of the reply to offset 0, which includes everything the server
+# does per accepted client before it can serve a request. It also reports request
+# throughput: several connections each repeating request -> full reply for offset 0.
+
+BIG_FILE = 'words_big.txt'
+
+# Function to build a large corpus by repeating the shipped words file
+def make_corpus(size_mb):
+    with open('words.txt', 'r') as f:
+        words = f.read()
+    target = size_mb * 1024 * 1024
+    with open(BIG_FILE, 'w') as f:
+        written = 0
+        while written < target:
+            f.write(words)
+            written += len(words)
+
+# Function to write a config for the given mode and start the server
+def run_server(config, mode):
+    config = dict(config, input_file=BIG_FILE, server_mode=mode)
+    with open('config.json', 'w') as f:
+        json.dump(config, f, indent=4)
+    return subprocess.Popen(['./server'], stdout=subprocess.DEVNULL)
+
+# Function to wait until the server accepts connections (loading the corpus takes a while);
+# gives up early if the server exits, e.g. for a mode it was not built with
+def wait_for_server(ip, port, server_process, timeout=120):
+    deadline = time.time() + timeout
+    while time.time() < deadline and server_process.poll() is None:
+        try:
+            socket.create_connection((ip, port)).close()
+            return True
+        except OSError:
+            time.sleep(0.1)
+    return False
+
+# Function to time connect -> request -> first byte for a number of fresh connections
+def measure(ip, port, connections):
+    times = []
+    for _ in range(connections):
+        start_time = time.perf_counter()
+        sock = socket.create_connection((ip, port))
+        sock.sendall(b'0\n')
+        sock.recv(1)
+        times.append(time.perf_counter() - start_time)
+        sock.close()
+    return [t * 1000 for t in times]  # milliseconds
+
+# Function to read the reply to offset 0 once, to learn how many bytes a reply has
+def reply_size(ip, port):
+    sock = socket.create_connection((ip, port))
+    sock.sendall(b'0\n')
+    sock.settimeout(0.5)
+    size = 0
+    try:
+        while True:
+            data = sock.recv(65536)
+            if not data:
+                break
+            size += len(data)
+    except socket.timeout:
+        pass
+    sock.close()
+    return size
+
+# Function to issue requests back to back on each of several connections, returning requests per second
+def measure_throughput(ip, port, connections, requests):
+    size = reply_size(ip, port)
+    if size == 0:
+        return 0.0
+
+    def worker():
+        sock = socket.create_connection((ip, port))
+        for _ in range(requests):
+            sock.sendall(b'0\n')
+            received = 0
+            while received < size:
+                received += len(sock.recv(size - received))
+        sock.close()
+
+    threads = [threading.Thread(target=worker) for _ in range(connections)]
+    start_time = time.perf_counter()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return connections * requests / (time.perf_counter() - start_time)
+
+# Function to pick a percentile from a list of samples
+def percentile(samples, q):
+    ordered = sorted(samples)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * q / 100))]
+
+def main():
+    size_mb = int(sys.argv[1]) if len(sys.argv) > 1 else 50
+    connections = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+    modes = sys.argv[3].split(',') if len(sys.argv) > 3 else ['thread', 'pool', 'steal', 'epoll', 'io_uring']
+
+    with open('config.json', 'r') as f:
+        original_text = f.read()
+    original_config = json.loads(original_text)
+
+    print(f"Generating {size_mb} MB corpus...")
+    make_corpus(size_mb)
+    subprocess.run(['make', 'build'])
+
+    ip, port = original_config['server_ip'], original_config['server_port']
+    try:
+        for mode in modes:
+            server_process = run_server(original_config, mode)
+            if not wait_for_server(ip, port, server_process):
+                print(f"Server did not start in mode {mode}")
+                server_process.kill()
+                continue
+
+            times = measure(ip, port, connections)
+            print(f"{mode:>10}: mean {statistics.mean(times):8.3f} ms, p50 {percentile(times, 50):8.3f} ms, "
+                  f"p99 {percentile(times, 99):8.3f} ms over {connections} connections")
+            rate = measure_throughput(ip, port, 8, 2000)
+            print(f"{mode:>10}: {rate:10.0f} requests/s over 8 connections")
+
+            server_process.terminate()
+            server_process.wait()
+    finally:
+        # Restore the original configuration
+        with open('config.json', 'w') as f:
+            f.write(original_text)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <climits>
+#include <sys/uio.h>
+#include "binary_protocol.hpp"
+#include "compression.hpp"
+
+// One request line pulled out of a RequestRing
+struct Request {
+    int offset = 0;
+    int count = 0;     // Words asked for, 0 for the server's k
+    int p = 0;         // Words per line of a text reply, 0 for the server's p
+    std::string text;  // The raw line when it is not a valid offset, or the word of a COUNT
+};
+
+// Per-connection receive buffer and request framer. Bytes are read straight into a fixed
+// ring (see free_space/commit or fill) and next() cuts complete newline-terminated
+// requests out of it in place, however many arrived in one read and wherever a read
+// split them, so the hot path never copies a request into a string. Once the client has
+// negotiated the binary protocol, requests are fixed-size frames instead of lines.
+class RequestRing {
+public:
+    static const size_t CAPACITY = 4096;  // Power of two; no request line can be longer
+
+    // OFFSET is a text request, STREAM a text request for every reply from the offset to
+    // the end of the file, FREQUENCY a request for the word counts of a range of the file
+    // (offset and count, 0 meaning to the end), RANGE_COUNT a request for how often one
+    // word occurs in such a range, FRAME a binary request, and SWITCH_BINARY the
+    // BINARY_HELLO line after which every request is a frame. SWITCH_IDS is the ID_HELLO
+    // line, after which every request is an ID_FRAME, answered with word IDs.
+    // SWITCH_COMPRESSED is the COMPRESS_HELLO line; requests stay text after it.
+    enum Result { NONE, OFFSET, INVALID, FRAME, SWITCH_BINARY, STREAM, FREQUENCY, RANGE_COUNT,
+                  SWITCH_IDS, ID_FRAME, SWITCH_COMPRESSED };
+
+    // Function to describe the free part of the ring as up to two buffers for readv;
+    // returns how many it used. There is always free space after next() returns NONE.
+    int free_space(iovec iov[2]) {
+        size_t free = CAPACITY - (tail - head);
+        size_t index = tail & MASK;
+        size_t first = free < CAPACITY - index ? free : CAPACITY - index;
+        iov[0].iov_base = data + index;
+        iov[0].iov_len = first;
+        if (free == first) {
+            return 1;
+        }
+        iov[1].iov_base = data;
+        iov[1].iov_len = free - first;
+        return 2;
+    }
+
+    // Function to account for length bytes written into the free space
+    void commit(size_t length) {
+        tail += length;
+    }
+
+    // Function to copy in as much of bytes as fits; returns how many were taken
+    size_t fill(const char* bytes, size_t length) {
+        iovec iov[2];
+        int parts = free_space(iov);
+        size_t taken = 0;
+        for (int i = 0; i < parts && taken < length; i++) {
+            size_t n = length - taken < iov[i].iov_len ? length - taken : iov[i].iov_len;
+            memcpy(iov[i].iov_base, bytes + taken, n);
+            taken += n;
+        }
+        commit(taken);
+        return taken;
+    }
+
+    // Function to take the next complete request. A text request is "offset [count [p]]",
+    // or "STREAM offset [count [p]]" to stream from offset to the end of the file, or
+    // "FREQ [offset [count]]" for the word counts of count words from offset (all of them),
+    // or "COUNT word [offset [count]]" for the occurrences of word among those words.
+    // The offset is read like stoi: leading whitespace, an optional sign, digits; count and
+    // p are optional unsigned numbers after it, and anything left over is ignored. A line
+    // that fills the whole ring without a newline is reported as INVALID once and skipped.
+    Result next(Request& request) {
+        if (binary) {
+            return next_frame(request);
+        }
+
+        while (true) {
+            uint64_t newline;
+            if (!find_newline(newline)) {
+                if (tail - head == CAPACITY) {
+                    head = tail;
+                    discarding = true;
+                    request.text = "request longer than " + std::to_string(CAPACITY) + " bytes";
+                    return INVALID;
+                }
+                return NONE;
+            }
+
+            uint64_t start = head;
+            head = newline + 1;
+            if (discarding) {
+                discarding = false;  // End of an overlong line that was already reported
+                continue;
+            }
+            if (matches(start, newline, BINARY_HELLO)) {
+                binary = true;
+                return SWITCH_BINARY;
+            }
+            if (matches(start, newline, ID_HELLO)) {
+                binary = ids = true;
+                return SWITCH_IDS;
+            }
+            if (matches(start, newline, COMPRESS_HELLO)) {
+                return SWITCH_COMPRESSED;
+            }
+            if (matches(start, newline, "FREQ\n")) {
+                request.offset = request.count = request.p = 0;
+                return FREQUENCY;
+            }
+            if (has_prefix(start, newline, "COUNT ")) {
+                return parse_count(start, newline, request);
+            }
+            return parse(start, newline, request);
+        }
+    }
+
+    bool is_binary() const {
+        return binary;
+    }
+
+    // Function to undo the switch SWITCH_IDS made, for a server that does not offer the ID
+    // protocol: the requests after the hello are read as text again
+    void refuse_ids() {
+        binary = ids = false;
+    }
+
+private:
+    static const size_t MASK = CAPACITY - 1;
+
+    // Function to find the next newline after the bytes already scanned, one memchr per
+    // contiguous part of the ring
+    bool find_newline(uint64_t& position) {
+        while (scanned < tail) {
+            size_t index = scanned & MASK;
+            size_t run = tail - scanned < CAPACITY - index ? tail - scanned : CAPACITY - index;
+            const char* hit = static_cast<const char*>(memchr(data + index, '\n', run));
+            if (hit != nullptr) {
+                position = scanned + (hit - (data + index));
+                scanned = position + 1;
+                return true;
+            }
+            scanned += run;
+        }
+        return false;
+    }
+
+    // Function to take the next fixed-size binary request, if all of it has arrived
+    Result next_frame(Request& request) {
+        if (tail - head < BINARY_REQUEST_SIZE) {
+            return NONE;
+        }
+        char frame[BINARY_REQUEST_SIZE];
+        for (size_t i = 0; i < BINARY_REQUEST_SIZE; i++) {
+            frame[i] = data[(head + i) & MASK];
+        }
+        head += BINARY_REQUEST_SIZE;
+        scanned = head;
+
+        uint32_t offset = get_u32(frame), count = get_u32(frame + 4);
+        request.offset = offset > INT_MAX ? INT_MAX : offset;
+        request.count = count > INT_MAX ? INT_MAX : count;
+        request.p = 0;
+        return ids ? ID_FRAME : FRAME;
+    }
+
+    // Function to check whether the line [start, end) is line (given with its newline),
+    // ignoring a carriage return before the newline
+    bool matches(uint64_t start, uint64_t end, const char* line) const {
+        size_t length = strlen(line) - 1;
+        if (end - start == length + 1 && data[(end - 1) & MASK] == '\r') {
+            end--;
+        }
+        if (end - start != length) {
+            return false;
+        }
+        for (size_t i = 0; i < length; i++) {
+            if (data[(start + i) & MASK] != line[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Function to check whether the line [start, end) begins with prefix
+    bool has_prefix(uint64_t start, uint64_t end, const char* prefix) const {
+        size_t length = strlen(prefix);
+        if (end - start < length) {
+            return false;
+        }
+        for (size_t i = 0; i < length; i++) {
+            if (data[(start + i) & MASK] != prefix[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Result parse(uint64_t start, uint64_t end, Request& request) {
+        Result kind = OFFSET;
+        uint64_t i = start;
+        if (has_prefix(start, end, "STREAM ")) {
+            kind = STREAM;
+            i += strlen("STREAM ");
+        } else if (has_prefix(start, end, "FREQ ")) {
+            kind = FREQUENCY;
+            i += strlen("FREQ ");
+        }
+        while (i < end && isspace((unsigned char)data[i & MASK])) {
+            i++;
+        }
+
+        bool negative = false;
+        if (i < end && (data[i & MASK] == '-' || data[i & MASK] == '+')) {
+            negative = data[i & MASK] == '-';
+            i++;
+        }
+
+        int64_t value = 0;
+        uint64_t first_digit = i;
+        bool overflow = false;
+        for (; i < end; i++) {
+            unsigned digit = (unsigned char)data[i & MASK] - '0';
+            if (digit > 9) {
+                break;
+            }
+            value = value * 10 + digit;
+            if (value > (int64_t)INT_MAX + negative) {
+                overflow = true;  // Out of range for an int, like stoi
+                break;
+            }
+        }
+
+        if (i == first_digit || overflow) {
+            request.text.clear();
+            for (uint64_t j = start; j < end; j++) {
+                request.text += data[j & MASK];
+            }
+            return INVALID;
+        }
+        request.offset = (int)(negative ? -value : value);
+
+        request.count = request.p = 0;
+        if (parse_field(i, end, request.count)) {
+            parse_field(i, end, request.p);
+        }
+        return kind;
+    }
+
+    // Function to read "COUNT word [offset [count]]": the word runs up to the next blank and
+    // the range defaults to the whole file
+    Result parse_count(uint64_t start, uint64_t end, Request& request) {
+        if (end > start && data[(end - 1) & MASK] == '\r') {
+            end--;
+        }
+        uint64_t i = start + strlen("COUNT ");
+        while (i < end && (data[i & MASK] == ' ' || data[i & MASK] == '\t')) {
+            i++;
+        }
+        request.text.clear();
+        for (; i < end && data[i & MASK] != ' ' && data[i & MASK] != '\t'; i++) {
+            request.text += data[i & MASK];
+        }
+        if (request.text.empty()) {
+            request.text = "COUNT without a word";
+            return INVALID;
+        }
+
+        request.offset = request.count = request.p = 0;
+        if (parse_field(i, end, request.offset)) {
+            parse_field(i, end, request.count);
+        }
+        return RANGE_COUNT;
+    }
+
+    // Function to read an optional unsigned number after blanks, saturating at INT_MAX;
+    // false (and i unchanged) when there is none
+    bool parse_field(uint64_t& i, uint64_t end, int& field) const {
+        uint64_t j = i;
+        while (j < end && (data[j & MASK] == ' ' || data[j & MASK] == '\t')) {
+            j++;
+        }
+        if (j == i || j == end || (unsigned char)data[j & MASK] - '0' > 9u) {
+            return false;
+        }
+
+        int64_t value = 0;
+        for (; j < end; j++) {
+            unsigned digit = (unsigned char)data[j & MASK] - '0';
+            if (digit > 9) {
+                break;
+            }
+            value = saturate(value * 10 + digit);
+        }
+        field = (int)value;
+        i = j;
+        return true;
+    }
+
+    static int64_t saturate(int64_t value) {
+        return value > INT_MAX ? INT_MAX : value;
+    }
+
+    char data[CAPACITY];
+    uint64_t head = 0;     // Start of the first request not yet taken
+    uint64_t tail = 0;     // End of the received bytes
+    uint64_t scanned = 0;  // Bytes before this are known to hold no unconsumed newline
+    bool discarding = false;
+    bool binary = false;   // The client switched to the binary protocol
+    bool ids = false;      // ... in its dictionary-encoded variant
+};
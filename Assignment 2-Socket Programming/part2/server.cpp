@@ -1,4 +1,3 @@
-#include <iostream>
 #include <fstream>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -8,92 +7,1834 @@
 #include <string>
 #include <cstring>
 #include "json.hpp"
+#include "logger.hpp"
+#include "corpus.hpp"
+#include "text_reply.hpp"
+#include "request_ring.hpp"
+#include "frequency.hpp"
+#include "word_dictionary.hpp"
+#include "word_index.hpp"
+#include "mpmc_queue.hpp"
+#include "work_stealing_deque.hpp"
 #include <thread>
 #include <atomic>
+#include <unordered_map>
+#include <memory>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <climits>
+#include <semaphore.h>
+#include <sys/eventfd.h>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <csignal>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 
 #define BUFFER_SIZE 1024
+#define MAX_EVENTS 1024
+#define MAX_PENDING_OUTPUT (1 << 20)  // Stop reading from a client whose replies pile up past this
+#define STREAM_BUFFER (256 << 10)     // Output a streaming connection keeps queued in the reactors
+#define TURN_BUDGET (256 << 10)       // Bytes a work-stealing worker moves for one connection before moving on
+#define STEAL_BATCH 16                // Ready connections a work-stealing worker takes from epoll at once
+#define URING_ENTRIES 4096            // Submission queue size of the io_uring backend
+#define URING_BUFFERS 4096            // Receive buffers shared by all io_uring connections (power of two)
+#define URING_BUFFER_GROUP 0
 using json = nlohmann::json;
 using namespace std;
 
 atomic<int> client_count(0);  // Atomic counter for client numbers
 
-// Function to split comma-separated words
-vector<string> split_words(const string &str) {
-    vector<string> words;
-    size_t start = 0, end = 0;
-    while ((end = str.find(',', start)) != string::npos) {
-        words.push_back(str.substr(start, end - start));
-        start = end + 1;
+// The corpus is loaded once at startup and never modified afterwards, so every
+// handler shares the same copy through this pointer instead of receiving its own
+using SharedWords = shared_ptr<const Corpus>;
+
+// Function to append the binary protocol reply for count words starting at offset: the
+// reply header, then every word behind its length (see binary_protocol.hpp)
+void append_binary_response(string& response, const Corpus& words, int offset, int count) {
+    size_t header = response.size();
+    response.resize(header + BINARY_REPLY_SIZE);
+
+    uint32_t flags = 0, sent = 0;
+    if (offset < 0 || offset >= words.size()) {
+        flags = BINARY_OUT_OF_RANGE;
+    } else {
+        size_t end = min<size_t>((size_t)offset + count, words.size());
+        for (size_t i = offset; i < end; i++) {
+            string_view word = words[i];
+            char length[4];
+            put_u32(length, word.size());
+            response.append(length, 4);
+            response += word;
+        }
+        sent = end - offset;
+        if (end == words.size()) {
+            flags = BINARY_EOF;
+        }
     }
-    if (start < str.size()) {
-        words.push_back(str.substr(start));
+
+    put_u32(&response[header], sent);
+    put_u32(&response[header + 4], response.size() - header - BINARY_REPLY_SIZE);
+    put_u32(&response[header + 8], flags);
+}
+
+// Function to append the ID protocol reply for count words starting at offset: the reply
+// header, then the dictionary ID of every word
+void append_id_response(string& response, const WordDictionary& dictionary, int offset, int count) {
+    const vector<uint32_t>& ids = dictionary.encoded();
+    size_t header = response.size();
+    response.resize(header + BINARY_REPLY_SIZE);
+
+    uint32_t flags = 0, sent = 0;
+    if (offset < 0 || offset >= ids.size()) {
+        flags = BINARY_OUT_OF_RANGE;
+    } else {
+        size_t end = min<size_t>((size_t)offset + count, ids.size());
+        sent = end - offset;
+        response.resize(header + BINARY_REPLY_SIZE + 4 * (size_t)sent);
+        char* out = &response[header + BINARY_REPLY_SIZE];
+        for (size_t i = offset; i < end; i++, out += 4) {
+            put_u32(out, ids[i]);
+        }
+        if (end == ids.size()) {
+            flags = BINARY_EOF;
+        }
     }
-    if (!words.empty() && words.back() == "\n") {
-        words.pop_back();
+
+    put_u32(&response[header], sent);
+    put_u32(&response[header + 4], 4 * sent);
+    put_u32(&response[header + 8], flags);
+}
+
+// Function to serialize the dictionary as the reply that follows ID_ACK: every word in ID
+// order behind its length, under a header flagged BINARY_DICTIONARY
+string dictionary_reply(const WordDictionary& dictionary) {
+    string reply(BINARY_REPLY_SIZE, '\0');
+    for (uint32_t id = 0; id < dictionary.size(); id++) {
+        char length[4];
+        put_u32(length, dictionary.word(id).size());
+        reply.append(length, 4);
+        reply += dictionary.word(id);
     }
-    return words;
+    put_u32(&reply[0], dictionary.size());
+    put_u32(&reply[4], reply.size() - BINARY_REPLY_SIZE);
+    put_u32(&reply[8], BINARY_DICTIONARY);
+    return reply;
 }
 
-// Function to handle each client
-void handle_client(int client_fd, const vector<string>& words, int k, int p, int client_number) {
-    char buffer[BUFFER_SIZE];
+// The replies for every offset that is a multiple of k, serialized back to back in
+// exactly the bytes append_response produces. Since the corpus, k and p never change,
+// serving one of these offsets is a slice of a single buffer.
+struct ResponseCache {
+    string wire;
+    vector<uint64_t> starts;  // Byte offset of the reply for offset c * k, plus the end of wire
+    int k;
+    int spill_fd = -1;        // Copy of wire in a file for sendfile, or -1 when not spilled
+
+    ~ResponseCache() {
+        if (spill_fd >= 0) {
+            close(spill_fd);
+        }
+    }
+
+    // Function to find where the reply for offset lives in wire (and in the spill file)
+    bool locate(int offset, uint64_t& start, uint64_t& length) const {
+        if (offset < 0 || offset % k != 0 || offset / k + 1 >= starts.size()) {
+            return false;
+        }
+        size_t chunk = offset / k;
+        start = starts[chunk];
+        length = starts[chunk + 1] - starts[chunk];
+        return true;
+    }
+
+    bool lookup(int offset, string_view& reply) const {
+        uint64_t start, length;
+        if (!locate(offset, start, length)) {
+            return false;
+        }
+        reply = string_view(wire.data() + start, length);
+        return true;
+    }
+
+    // Function to write wire to a file the kernel can send from directly. The file is
+    // unlinked once open, so it lives exactly as long as the server.
+    bool spill(const string& path) {
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) {
+            return false;
+        }
+        unlink(path.c_str());
+
+        size_t written = 0;
+        while (written < wire.size()) {
+            ssize_t n = write(fd, wire.data() + written, wire.size() - written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                close(fd);
+                return false;
+            }
+            written += n;
+        }
+        spill_fd = fd;
+        return true;
+    }
+};
+
+// Function to serialize the reply for every aligned offset of the corpus, spilling it to
+// spill_path for zero-copy sends unless the path is empty
+shared_ptr<const ResponseCache> build_response_cache(const Corpus& words, int k, int p, const string& spill_path) {
+    shared_ptr<ResponseCache> cache = make_shared<ResponseCache>();
+    cache->k = k;
+    size_t chunks = (words.size() + k - 1) / k;
+    cache->starts.reserve(chunks + 1);
+    cache->wire.reserve(words.bytes() + words.size() / p + chunks + 4);
+
+    for (size_t chunk = 0; chunk < chunks; chunk++) {
+        cache->starts.push_back(cache->wire.size());
+        append_response(cache->wire, words, chunk * k, k, p);
+    }
+    cache->starts.push_back(cache->wire.size());
+
+    if (!spill_path.empty() && !cache->spill(spill_path)) {
+        LOG(LOG_ERROR) << "Error: Unable to write spill file " << spill_path << ", serving from memory";
+    }
+    return cache;
+}
+
+// Function to compress every reply of a response cache into the frame a compressed
+// connection gets for it, once, so those replies cost no compression when served
+shared_ptr<const ResponseCache> build_compressed_cache(const ResponseCache& plain) {
+    shared_ptr<ResponseCache> cache = make_shared<ResponseCache>();
+    cache->k = plain.k;
+    cache->starts.reserve(plain.starts.size());
+    for (size_t chunk = 0; chunk + 1 < plain.starts.size(); chunk++) {
+        cache->starts.push_back(cache->wire.size());
+        append_compressed_frame(cache->wire, plain.wire.data() + plain.starts[chunk],
+                                plain.starts[chunk + 1] - plain.starts[chunk]);
+    }
+    cache->starts.push_back(cache->wire.size());
+    cache->wire.shrink_to_fit();
+    return cache;
+}
+
+// The range index behind COUNT. With range_index it is built at startup; otherwise the
+// first COUNT builds it, with its own dictionary unless the ID protocol made one, so a
+// server that never sees a COUNT never pays for it. Concurrent first callers wait for
+// the one build.
+class RangeIndex {
+public:
+    RangeIndex(SharedWords words, shared_ptr<const WordDictionary> dictionary, int threads)
+        : words(words), dictionary(dictionary), threads(threads) {}
+
+    // Function to get the index if it has been built, without waiting
+    const WordIndex* built() const {
+        return ready.load(memory_order_acquire);
+    }
+
+    // Function to get the index, building it first if nobody has
+    const WordIndex& get() {
+        call_once(once, [this]() {
+            if (dictionary == nullptr) {
+                shared_ptr<WordDictionary> own = make_shared<WordDictionary>();
+                own->build(*words, threads);
+                dictionary = own;
+            }
+            index.build(*dictionary);
+            ready.store(&index, memory_order_release);
+            LOG(LOG_INFO) << "Range index built: " << index.list_bytes() << " bytes of offsets";
+        });
+        return index;
+    }
+
+private:
+    SharedWords words;
+    shared_ptr<const WordDictionary> dictionary;
+    int threads;
+    once_flag once;
+    WordIndex index;
+    atomic<const WordIndex*> ready{nullptr};
+};
+
+// A reply too slow to build on a reactor thread (a COUNT before the range index exists),
+// built by the BackgroundWork thread instead. Its connection holds the requests after it
+// until it is ready, so replies stay in order. A reactor with nothing else to do for the
+// connection parks it; completing a parked reply calls wake, which hands the connection
+// back to its reactor. state settles which side comes last.
+struct DeferredReply {
+    enum State { RUNNING, PARKED, DONE };
+    using Wake = function<void(const shared_ptr<DeferredReply>&)>;
+
+    string reply;
+    atomic<int> state{RUNNING};
+    Wake wake;
+
+    bool ready() const {
+        return state.load(memory_order_acquire) == DONE;
+    }
+
+    // Function to leave the connection to wake until the reply is done; false if it
+    // already is, so the connection should carry on now
+    bool park(Wake on_done) {
+        wake = move(on_done);
+        int expected = RUNNING;
+        return state.compare_exchange_strong(expected, PARKED, memory_order_acq_rel);
+    }
+
+    // Function to mark the reply built, waking its connection if it was parked
+    static void complete(const shared_ptr<DeferredReply>& deferred) {
+        if (deferred->state.exchange(DONE, memory_order_acq_rel) == PARKED) {
+            deferred->wake(deferred);
+        }
+    }
+};
+
+// Thread that builds the deferred replies of the reactors, one at a time in the order
+// they were asked for. A connection has at most one reply deferred, so the queue is never
+// longer than the number of connections.
+class BackgroundWork {
+public:
+    BackgroundWork() : worker([this]() { run(); }) {}
+
+    ~BackgroundWork() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        worker.join();
+    }
+
+    void submit(function<void()> job) {
+        {
+            lock_guard<mutex> guard(lock);
+            jobs.push_back(move(job));
+        }
+        wakeup.notify_one();
+    }
+
+private:
+    void run() {
+        while (true) {
+            function<void()> job;
+            {
+                unique_lock<mutex> guard(lock);
+                wakeup.wait(guard, [this]() { return stopping || !jobs.empty(); });
+                if (stopping) {
+                    return;
+                }
+                job = move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    mutex lock;
+    condition_variable wakeup;
+    deque<function<void()>> jobs;
+    bool stopping = false;
+    thread worker;  // Last, so it starts once the rest is ready
+};
+
+// Read-only state shared by every handler, built once in main
+struct ServerContext {
+    SharedWords words;
+    int k;
+    int p;
+    int max_count;  // Most words a single request may ask for
+    shared_ptr<const ResponseCache> cache;  // Null unless response_cache is enabled
+    shared_ptr<const ResponseCache> compressed_cache;  // Frames of the cached replies, null unless compressed_cache is enabled
+    shared_ptr<const string> frequencies;   // Frequency reply for the whole file, built at load
+    shared_ptr<const WordDictionary> dictionary;  // The corpus as word IDs, null unless id_protocol or range_index is enabled
+    shared_ptr<const string> id_greeting;   // ID_ACK and the dictionary reply sent on ID_HELLO, null unless id_protocol is enabled
+    shared_ptr<RangeIndex> index;           // Built at startup with range_index, else by the first COUNT
+    BackgroundWork* background = nullptr;   // Builds slow replies for the reactor modes; null where handlers may block
+    int frequency_threads = 1;              // Threads counting the whole file at load, and each range counted in the background
+
+    // Function to pick how many words a request gets: k unless it asks for a count, which
+    // is capped at max_count
+    int words_for(int count) const {
+        return count <= 0 ? k : min(count, max_count);
+    }
+
+    // Function to tell whether a request's count was cut down to max_count
+    bool capped(int count) const {
+        return count > max_count;
+    }
+
+    // Function to pick how many words go on each line of a text reply: p unless the request
+    // asks for its own
+    int words_per_line(int request_p) const {
+        return request_p <= 0 ? p : request_p;
+    }
+
+    // Function to tell whether a reply of count words with line_words per line is the one
+    // the response cache holds
+    bool cacheable(int count, int line_words) const {
+        return cache != nullptr && count == k && line_words == p;
+    }
+
+    // Function to find the reply for offset in the spill file; false if it must be built
+    bool spilled(int offset, uint64_t& start, uint64_t& length) const {
+        return cache != nullptr && cache->spill_fd >= 0 && cache->locate(offset, start, length);
+    }
+
+    // Function to find the end of the FREQ range of count words from offset (0 for the
+    // rest of the file)
+    size_t frequency_end(int offset, int count) const {
+        return count <= 0 ? words->size() : min<size_t>((size_t)offset + count, words->size());
+    }
+
+    // Function to append the frequency reply for count words from offset (0 for the rest of
+    // the file). A range covering the whole file gets the table built at load; any other
+    // range is counted on the spot with threads threads, by the handler in the thread and
+    // io_uring modes and by the background thread in the reactor modes.
+    void append_frequencies(string& output, int offset, int count, int threads = 1) const {
+        if (offset < 0 || offset >= words->size()) {
+            output += "$$\n";
+            return;
+        }
+        size_t last = frequency_end(offset, count);
+        if (offset == 0 && last == words->size()) {
+            output += *frequencies;
+        } else {
+            output += frequency_reply(count_words(*words, offset, last, threads));
+        }
+    }
+
+    // Function to tell whether a FREQ has a range to count rather than the table built at
+    // load, which the reactor modes leave to the background thread
+    bool frequencies_are_slow(int offset, int count) const {
+        if (background == nullptr || offset < 0 || offset >= words->size()) {
+            return false;
+        }
+        return offset > 0 || frequency_end(offset, count) < words->size();
+    }
+
+    // Function to append the reply to "COUNT word offset count": "COUNT <occurrences>\n",
+    // looked up in the range index, which the first COUNT builds if range_index did not
+    void append_range_count(string& output, const Request& request) const {
+        if (request.offset >= words->size()) {
+            output += "$$\n";
+            return;
+        }
+        size_t first = request.offset;
+        size_t last = request.count <= 0 ? words->size() : min<size_t>(first + request.count, words->size());
+        output += "COUNT " + to_string(index->get().count(request.text, first, last)) + "\n";
+    }
+
+    // Function to tell whether a COUNT would have to build the range index first, which
+    // the reactor modes leave to the background thread
+    bool count_is_slow() const {
+        return background != nullptr && index->built() == nullptr;
+    }
+};
+
+// Function to append the reply for offset as a compressed frame: ready made in the
+// compressed cache when it holds it, otherwise compressed now
+void append_compressed_response(string& output, const ServerContext& ctx, int offset, int count, int line_words,
+                                bool capped = false) {
+    bool cacheable = !capped && ctx.cacheable(count, line_words);
+    string_view cached;
+    if (cacheable && ctx.compressed_cache != nullptr && ctx.compressed_cache->lookup(offset, cached)) {
+        output += cached;
+    } else if (cacheable && ctx.cache->lookup(offset, cached)) {
+        append_compressed_frame(output, cached.data(), cached.size());
+    } else {
+        string reply;
+        append_response(reply, *ctx.words, offset, count, line_words, capped);
+        append_compressed_frame(output, reply.data(), reply.size());
+    }
+}
+
+// Function to turn everything output holds from start on into one compressed frame
+void compress_tail(string& output, size_t start) {
+    string reply = output.substr(start);
+    output.resize(start);
+    append_compressed_frame(output, reply.data(), reply.size());
+}
+
+// Function to write every buffer in iov to a blocking socket, IOV_MAX at a time with one
+// writev each; false means the peer is gone
+bool send_iovecs(int fd, vector<iovec>& iov) {
+    size_t next = 0;
+    while (next < iov.size()) {
+        ssize_t n = writev(fd, iov.data() + next, min<size_t>(iov.size() - next, IOV_MAX));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+
+        // Skip the buffers that were written completely and trim a partial one
+        while (next < iov.size() && (size_t)n >= iov[next].iov_len) {
+            n -= iov[next].iov_len;
+            next++;
+        }
+        if (n > 0) {
+            iov[next].iov_base = (char*)iov[next].iov_base + n;
+            iov[next].iov_len -= n;
+        }
+    }
+    return true;
+}
+
+// Function to send length bytes of file_fd starting at offset on a blocking socket
+// without copying them through user space; false means the peer is gone
+bool send_file_range(int fd, int file_fd, off_t offset, size_t length) {
+    while (length > 0) {
+        ssize_t n = sendfile(fd, file_fd, &offset, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        length -= n;
+    }
+    return true;
+}
+
+// Function to answer one text request on a blocking socket, with a compressed frame if
+// compressed is set
+void serve_request(int client_fd, const ServerContext& ctx, int client_number, const Request& request, vector<iovec>& iov,
+                   bool compressed) {
+    const Corpus& words = *ctx.words;
+    int offset = request.offset;
+    int count = ctx.words_for(request.count), line_words = ctx.words_per_line(request.p);
+    bool capped = ctx.capped(request.count);
+    bool cacheable = !capped && ctx.cacheable(count, line_words);
+
+    LOG(LOG_DEBUG) << "Client #" << client_number << " requested offset: " << offset;
+
+    if (offset >= words.size()) {
+        LOG(LOG_DEBUG) << "Client #" << client_number << " offset " << offset << " exceeds file size. Sending $$.";
+    } else if ((size_t)offset + count >= words.size()) {
+        LOG(LOG_DEBUG) << "Client #" << client_number << ": End of file reached. Sending EOF.";
+    }
+
+    if (compressed) {
+        string frame;
+        append_compressed_response(frame, ctx, offset, count, line_words, capped);
+        send(client_fd, frame.data(), frame.size(), 0);
+        return;
+    }
+
+    // Send the response, straight from the spill file or the cache when they hold this
+    // offset, otherwise gathered from the corpus in one writev
+    uint64_t start, length;
+    string_view cached;
+    if (cacheable && ctx.spilled(offset, start, length)) {
+        send_file_range(client_fd, ctx.cache->spill_fd, start, length);
+    } else if (cacheable && ctx.cache->lookup(offset, cached)) {
+        send(client_fd, cached.data(), cached.size(), 0);
+    } else {
+        iov.clear();
+        gather_response(iov, words, offset, count, line_words, capped);
+        send_iovecs(client_fd, iov);
+    }
+}
+
+// Function to tell whether the reply for offset is the last one of a stream: it reaches the
+// end of the file (EOF) or starts past it ($$)
+bool last_reply(const Corpus& words, int offset, int count) {
+    return offset < 0 || (size_t)offset + count >= words.size();
+}
+
+// Function to answer a STREAM request on a blocking socket: every reply from offset on,
+// count words apart, up to and including the one with EOF. These are exactly the bytes a
+// client looping over offsets would receive, without the round trips. Aligned offsets
+// are sent as one slice of the cache (or spill file) running to its end; otherwise the
+// replies are gathered IOV_MAX buffers at a time. With compressed set every reply is a
+// compressed frame, from the compressed cache or compressed STREAM_BUFFER bytes at a
+// time. A blocking send only returns once the socket has taken the bytes, so the
+// client's reading paces the stream.
+void serve_stream(int client_fd, const ServerContext& ctx, int client_number, const Request& request, vector<iovec>& iov,
+                  bool compressed) {
+    const Corpus& words = *ctx.words;
+    int count = ctx.words_for(request.count), line_words = ctx.words_per_line(request.p);
+
+    LOG(LOG_DEBUG) << "Client #" << client_number << " requested a stream from offset: " << request.offset;
+
+    uint64_t start, length;
+    const ResponseCache* cache = compressed ? ctx.compressed_cache.get() : ctx.cache.get();
+    if (ctx.cacheable(count, line_words) && cache != nullptr && cache->locate(request.offset, start, length)) {
+        length = cache->wire.size() - start;
+        if (cache->spill_fd >= 0) {
+            send_file_range(client_fd, cache->spill_fd, start, length);
+        } else {
+            iov.assign(1, {(void*)(cache->wire.data() + start), length});
+            send_iovecs(client_fd, iov);
+        }
+        return;
+    }
+
+    int offset = request.offset;
+    bool done = false;
+    if (compressed) {
+        string frames;
+        while (!done) {
+            frames.clear();
+            while (!done && frames.size() < STREAM_BUFFER) {
+                append_compressed_response(frames, ctx, offset, count, line_words);
+                done = last_reply(words, offset, count);
+                offset += count;
+            }
+            iov.assign(1, {(void*)frames.data(), frames.size()});
+            if (!send_iovecs(client_fd, iov)) {
+                return;
+            }
+        }
+        return;
+    }
+    while (!done) {
+        iov.clear();
+        while (!done && iov.size() < IOV_MAX) {
+            gather_response(iov, words, offset, count, line_words);
+            done = last_reply(words, offset, count);
+            offset += count;
+        }
+        if (!send_iovecs(client_fd, iov)) {
+            return;
+        }
+    }
+}
+
+// Function to send a reply built in reply on a blocking socket, as a compressed frame if
+// compressed is set
+void send_reply(int client_fd, const string& reply, bool compressed) {
+    if (!compressed) {
+        send(client_fd, reply.data(), reply.size(), 0);
+        return;
+    }
+    string frame;
+    append_compressed_frame(frame, reply.data(), reply.size());
+    send(client_fd, frame.data(), frame.size(), 0);
+}
+
+// Function to handle each client. A read can hold several pipelined requests or part of
+// one, so every complete line is answered in order and the rest waits for the next read.
+void handle_client(int client_fd, ServerContext ctx, int client_number) {
+    RequestRing input;
+    Request request;
+    vector<iovec> iov;
+    string scratch;
+    bool compressed = false;  // The client asked for compressed replies
     
-    cout << "Client #" << client_number << " connected." << endl;
+    LOG(LOG_DEBUG) << "Client #" << client_number << " connected.";
     
-    while (recv(client_fd, buffer, BUFFER_SIZE, 0) > 0) {
-        buffer[strcspn(buffer, "\n")] = 0; // Remove newline character
-        string request(buffer);
-
-        // Attempt to convert request to an integer (offset)
-        int offset = 0;
-        try {
-            offset = stoi(request);
-        } catch (invalid_argument&) {
-            cerr << "Client #" << client_number << " sent an invalid offset: " << request << endl;
-            send(client_fd, "Invalid offset\n", 15, 0);
+    while (true) {
+        iovec space[2];
+        ssize_t len = readv(client_fd, space, input.free_space(space));
+        if (len < 0 && errno == EINTR) {
             continue;
         }
+        if (len <= 0) {
+            break;
+        }
+        input.commit(len);
+
+        RequestRing::Result result;
+        while ((result = input.next(request)) != RequestRing::NONE) {
+            if (result == RequestRing::INVALID) {
+                LOG(LOG_WARN) << "Client #" << client_number << " sent an invalid offset: " << request.text;
+                send_reply(client_fd, "Invalid offset\n", compressed);
+            } else if (result == RequestRing::SWITCH_COMPRESSED) {
+                LOG(LOG_DEBUG) << "Client #" << client_number << " switched to compressed replies.";
+                send(client_fd, COMPRESS_ACK, strlen(COMPRESS_ACK), 0);
+                compressed = true;
+            } else if (result == RequestRing::SWITCH_BINARY) {
+                LOG(LOG_DEBUG) << "Client #" << client_number << " switched to the binary protocol.";
+                send_reply(client_fd, BINARY_ACK, compressed);
+            } else if (result == RequestRing::FRAME) {
+                scratch.clear();
+                append_binary_response(scratch, *ctx.words, request.offset, ctx.words_for(request.count));
+                send_reply(client_fd, scratch, compressed);
+            } else if (result == RequestRing::SWITCH_IDS && ctx.id_greeting == nullptr) {
+                LOG(LOG_WARN) << "Client #" << client_number << " asked for the ID protocol, which is not enabled";
+                input.refuse_ids();
+                send_reply(client_fd, "Invalid offset\n", compressed);
+            } else if (result == RequestRing::SWITCH_IDS) {
+                LOG(LOG_DEBUG) << "Client #" << client_number << " switched to the ID protocol.";
+                send_reply(client_fd, *ctx.id_greeting, compressed);
+            } else if (result == RequestRing::ID_FRAME) {
+                scratch.clear();
+                append_id_response(scratch, *ctx.dictionary, request.offset, ctx.words_for(request.count));
+                send_reply(client_fd, scratch, compressed);
+            } else if (result == RequestRing::STREAM) {
+                serve_stream(client_fd, ctx, client_number, request, iov, compressed);
+            } else if (result == RequestRing::FREQUENCY) {
+                LOG(LOG_DEBUG) << "Client #" << client_number << " requested word frequencies from offset: " << request.offset;
+                scratch.clear();
+                ctx.append_frequencies(scratch, request.offset, request.count);
+                send_reply(client_fd, scratch, compressed);
+            } else if (result == RequestRing::RANGE_COUNT) {
+                LOG(LOG_DEBUG) << "Client #" << client_number << " requested the count of " << request.text << " from offset: " << request.offset;
+                scratch.clear();
+                ctx.append_range_count(scratch, request);
+                send_reply(client_fd, scratch, compressed);
+            } else {
+                serve_request(client_fd, ctx, client_number, request, iov, compressed);
+            }
+        }
+    }
+
+    LOG(LOG_DEBUG) << "Client #" << client_number << " disconnected.";
+    close(client_fd);
+}
+
+// Per-connection state kept by the epoll reactor
+struct Connection {
+    int client_number;
+    RequestRing input;   // Received bytes, framed into requests in place
+    string output;       // Replies not yet accepted by the socket
+    size_t sent = 0;     // Bytes of output already sent
+    off_t file_offset = 0;      // Range of the spill file still to be sent, ahead of output
+    size_t file_remaining = 0;
+    uint32_t events = EPOLLIN | EPOLLRDHUP;  // Events currently registered with epoll
+    int stream_next = -1;       // Next offset of a STREAM request being served, or -1
+    int stream_count = 0;
+    int stream_p = 0;
+    bool compressed = false;    // The client asked for compressed replies
+    bool holding = false;       // Requests were left in input while the replies were backed up
+    bool read_closed = false;   // The client shut down its side; answer what it sent, then close
+    shared_ptr<DeferredReply> deferred;  // A reply being built off the reactor; the requests after it wait
+
+    bool streaming() const {
+        return stream_next >= 0;
+    }
+
+    bool waiting() const {
+        return deferred != nullptr && !deferred->ready();
+    }
+
+    size_t queued() const {
+        return output.size() - sent + file_remaining;
+    }
+
+    // The client is not reading its replies fast enough: take no more requests until
+    // they drain
+    bool backed_up() const {
+        return queued() > MAX_PENDING_OUTPUT;
+    }
+};
+
+// Function to raise the open file limit so a single process can hold many connections
+void raise_fd_limit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Function to queue more of the connection's stream, until STREAM_BUFFER bytes are waiting
+// or the stream ends. Aligned offsets with a spill file queue the rest of the file in one
+// range. Returns true once the stream is finished.
+bool pump_stream(Connection& conn, const ServerContext& ctx) {
+    const Corpus& words = *ctx.words;
+    bool cacheable = ctx.cacheable(conn.stream_count, conn.stream_p);
+
+    while (conn.streaming() && conn.queued() < STREAM_BUFFER) {
+        int offset = conn.stream_next;
+        uint64_t start, length;
+        if (cacheable && !conn.compressed && conn.queued() == 0 && ctx.spilled(offset, start, length)) {
+            conn.file_offset = start;
+            conn.file_remaining = ctx.cache->wire.size() - start;
+            conn.stream_next = -1;
+            break;
+        }
 
-        cout << "Client #" << client_number << " requested offset: " << offset << endl;
+        string_view cached;
+        if (conn.compressed) {
+            append_compressed_response(conn.output, ctx, offset, conn.stream_count, conn.stream_p);
+        } else if (cacheable && ctx.cache->lookup(offset, cached)) {
+            conn.output += cached;
+        } else {
+            append_response(conn.output, words, offset, conn.stream_count, conn.stream_p);
+        }
+        conn.stream_next = last_reply(words, offset, conn.stream_count) ? -1 : offset + conn.stream_count;
+    }
+    return !conn.streaming();
+}
 
-        if (offset >= words.size()) {
-            cout << "Client #" << client_number << " offset " << offset << " exceeds file size. Sending $$." << endl;
-            send(client_fd, "$$\n", 3, 0);
+// Function to have the background thread build a reply with build, holding the
+// connection's later requests until it is ready (see DeferredReply)
+void defer_reply(Connection& conn, const ServerContext& ctx, function<void(string&)> build) {
+    shared_ptr<DeferredReply> deferred = make_shared<DeferredReply>();
+    conn.deferred = deferred;
+    ctx.background->submit([deferred, build]() {
+        build(deferred->reply);
+        DeferredReply::complete(deferred);
+    });
+}
+
+// Function to queue the reply to one request. Offset requests and streams are queued as
+// compressed frames by themselves when the client asked for them; the caller frames the
+// other replies.
+void queue_reply(Connection& conn, const ServerContext& ctx, RequestRing::Result result, const Request& request) {
+    if (result == RequestRing::INVALID) {
+        LOG(LOG_WARN) << "Client #" << conn.client_number << " sent an invalid offset: " << request.text;
+        conn.output += "Invalid offset\n";
+        return;
+    }
+    if (result == RequestRing::SWITCH_COMPRESSED) {
+        LOG(LOG_DEBUG) << "Client #" << conn.client_number << " switched to compressed replies.";
+        conn.output += COMPRESS_ACK;
+        conn.compressed = true;
+        return;
+    }
+    if (result == RequestRing::SWITCH_BINARY) {
+        LOG(LOG_DEBUG) << "Client #" << conn.client_number << " switched to the binary protocol.";
+        conn.output += BINARY_ACK;
+        return;
+    }
+    if (result == RequestRing::FRAME) {
+        append_binary_response(conn.output, *ctx.words, request.offset, ctx.words_for(request.count));
+        return;
+    }
+    if (result == RequestRing::SWITCH_IDS && ctx.id_greeting == nullptr) {
+        // Answered like an older server would, so the client falls back
+        LOG(LOG_WARN) << "Client #" << conn.client_number << " asked for the ID protocol, which is not enabled";
+        conn.input.refuse_ids();
+        conn.output += "Invalid offset\n";
+        return;
+    }
+    if (result == RequestRing::SWITCH_IDS) {
+        LOG(LOG_DEBUG) << "Client #" << conn.client_number << " switched to the ID protocol.";
+        conn.output += *ctx.id_greeting;
+        return;
+    }
+    if (result == RequestRing::ID_FRAME) {
+        append_id_response(conn.output, *ctx.dictionary, request.offset, ctx.words_for(request.count));
+        return;
+    }
+    if (result == RequestRing::FREQUENCY) {
+        LOG(LOG_DEBUG) << "Client #" << conn.client_number << " requested word frequencies from offset: " << request.offset;
+        if (ctx.frequencies_are_slow(request.offset, request.count)) {
+            defer_reply(conn, ctx, [&ctx, request](string& reply) {
+                ctx.append_frequencies(reply, request.offset, request.count, ctx.frequency_threads);
+            });
+        } else {
+            ctx.append_frequencies(conn.output, request.offset, request.count);
+        }
+        return;
+    }
+    if (result == RequestRing::RANGE_COUNT) {
+        LOG(LOG_DEBUG) << "Client #" << conn.client_number << " requested the count of " << request.text << " from offset: " << request.offset;
+        if (ctx.count_is_slow()) {
+            defer_reply(conn, ctx, [&ctx, request](string& reply) { ctx.append_range_count(reply, request); });
         } else {
-            string response = "";
-            int count = 0;
+            ctx.append_range_count(conn.output, request);
+        }
+        return;
+    }
+    int offset = request.offset;
+    int count = ctx.words_for(request.count), line_words = ctx.words_per_line(request.p);
+    bool capped = ctx.capped(request.count);
+    bool cacheable = !capped && ctx.cacheable(count, line_words);
+
+    if (result == RequestRing::STREAM) {
+        LOG(LOG_DEBUG) << "Client #" << conn.client_number << " requested a stream from offset: " << offset;
+        conn.stream_next = offset < 0 ? INT_MAX : offset;  // A negative offset streams just $$
+        conn.stream_count = count;
+        conn.stream_p = line_words;
+        return;
+    }
+
+    LOG(LOG_DEBUG) << "Client #" << conn.client_number << " requested offset: " << offset;
+
+    if (conn.compressed) {
+        append_compressed_response(conn.output, ctx, offset, count, line_words, capped);
+        return;
+    }
+
+    // A cached reply is queued as a range of the spill file if nothing else is waiting,
+    // or if it directly follows the range already queued (consecutive aligned offsets)
+    uint64_t start, length;
+    if (cacheable && conn.output.empty() && ctx.spilled(offset, start, length)) {
+        if (conn.file_remaining == 0) {
+            conn.file_offset = start;
+            conn.file_remaining = length;
+            return;
+        }
+        if (conn.file_offset + conn.file_remaining == start) {
+            conn.file_remaining += length;
+            return;
+        }
+    }
+    string_view cached;
+    if (cacheable && ctx.cache->lookup(offset, cached)) {
+        conn.output += cached;
+    } else {
+        append_response(conn.output, *ctx.words, offset, count, line_words, capped);
+    }
+}
+
+// Function to turn every complete request line in the connection's input into a queued reply.
+// A STREAM request holds back the requests after it until its last reply is queued, and
+// once more than MAX_PENDING_OUTPUT bytes are queued the rest stay in the ring, so this
+// is called again whenever the connection's output drains. A deferred reply holds them
+// back until it is ready, and is queued in its turn.
+void process_requests(Connection& conn, const ServerContext& ctx) {
+    Request request;
+    RequestRing::Result result;
+    while (true) {
+        if (conn.deferred != nullptr) {
+            if (!conn.deferred->ready()) {
+                conn.holding = false;  // Taken up again when the reply is ready, not when the output drains
+                return;
+            }
+            size_t reply_start = conn.output.size();
+            conn.output += conn.deferred->reply;
+            if (conn.compressed) {
+                compress_tail(conn.output, reply_start);
+            }
+            conn.deferred.reset();
+        }
+        if (conn.streaming() && !pump_stream(conn, ctx)) {
+            return;
+        }
+        if (conn.backed_up()) {
+            conn.holding = true;
+            return;
+        }
+        if ((result = conn.input.next(request)) == RequestRing::NONE) {
+            conn.holding = false;
+            return;
+        }
+
+        size_t reply_start = conn.output.size();
+        bool needs_frame = conn.compressed && result != RequestRing::OFFSET && result != RequestRing::STREAM;
+        queue_reply(conn, ctx, result, request);
+        if (needs_frame && conn.deferred == nullptr) {
+            compress_tail(conn.output, reply_start);
+        }
+    }
+}
 
-            for (int i = offset; i < offset + k && i < words.size(); i++) {
-                response += words[i] + ",";
-                count++;
-                if (count >= p) {
-                    response += "\n";  // Add a newline after p words
-                    count = 0;
+bool has_pending_output(const Connection& conn) {
+    return conn.file_remaining > 0 || conn.sent < conn.output.size();
+}
+
+// Function to tell whether process_requests has more to queue once the output drains: a
+// stream to top up, requests held back while backed up, or a deferred reply now ready
+bool has_more(const Connection& conn) {
+    return conn.streaming() || conn.holding || (conn.deferred != nullptr && conn.deferred->ready());
+}
+
+// Function to write as much queued output as the socket accepts, the spill file range
+// first; false means the peer is gone
+bool flush_output(int fd, Connection& conn, const ServerContext& ctx) {
+    while (conn.file_remaining > 0) {
+        ssize_t n = sendfile(fd, ctx.cache->spill_fd, &conn.file_offset, conn.file_remaining);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (n == 0) {
+            return false;
+        }
+        conn.file_remaining -= n;
+    }
+
+    while (conn.sent < conn.output.size()) {
+        ssize_t n = send(fd, conn.output.data() + conn.sent, conn.output.size() - conn.sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn.sent += n;
+    }
+    conn.output.clear();
+    conn.sent = 0;
+    return true;
+}
+
+// Function to work out the events a connection should wait for: stop reading while its
+// replies are backed up, a stream is being served, a reply is deferred or the client has
+// shut down its side, and wait for writability until they drain and the requests held
+// back are answered
+uint32_t interest_events(const Connection& conn) {
+    bool pending = has_pending_output(conn) || has_more(conn);
+    bool reading = !conn.backed_up() && !conn.streaming() && conn.deferred == nullptr && !conn.read_closed;
+    return (reading ? EPOLLIN | EPOLLRDHUP : 0) | (pending ? EPOLLOUT : 0);
+}
+
+// Function to update the events a connection is registered for, if they changed
+void update_interest(int epoll_fd, int fd, Connection& conn) {
+    uint32_t events = interest_events(conn);
+    if (events == conn.events) {
+        return;
+    }
+
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    conn.events = events;
+}
+
+void close_connection(int epoll_fd, int fd, unordered_map<int, Connection>& connections) {
+    LOG(LOG_DEBUG) << "Client #" << connections[fd].client_number << " disconnected.";
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    connections.erase(fd);
+}
+
+// Function to create a TCP socket listening on the given port; with reuse_port several
+// sockets can bind the same port and the kernel load-balances connections between them
+int open_listener(int port, bool reuse_port) {
+    struct sockaddr_in server_addr;
+
+    // Create socket
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        LOG(LOG_ERROR) << "Error: Socket creation failed";
+        return -1;
+    }
+
+    int enable = 1;
+    if (reuse_port && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+        LOG(LOG_ERROR) << "Error: Setting SO_REUSEPORT failed";
+        close(server_fd);
+        return -1;
+    }
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    // Bind socket
+    if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        LOG(LOG_ERROR) << "Error: Binding failed";
+        close(server_fd);
+        return -1;
+    }
+
+    // Start listening
+    if (listen(server_fd, SOMAXCONN) < 0) {
+        LOG(LOG_ERROR) << "Error: Listening failed";
+        close(server_fd);
+        return -1;
+    }
+    return server_fd;
+}
+
+// Function to do everything a ready connection allows without blocking: read and answer
+// its requests if ready says it is readable, then send what is queued, topping a stream
+// up (or answering the requests held back) for as long as the socket takes it all.
+// Reading stops while the replies are backed up, so a client that sends requests
+// without reading the replies only fills its socket buffers. budget caps the bytes read plus the stream
+// bytes queued in one call, so a busy connection can be set aside for others and picked
+// up again; whatever is left over still shows up in interest_events. A client that shuts
+// down its side (a half-close after its last request) still gets every reply: reading
+// stops, and the connection is finished once those are sent. Returns false once the
+// connection is finished or failed.
+bool service_connection(int fd, Connection& conn, const ServerContext& ctx, uint32_t ready, size_t budget = SIZE_MAX) {
+    bool alive = true;
+    size_t spent = 0;
+
+    if (ready & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        // Drain the socket straight into the request ring, answering every complete
+        // request line after each read so the ring always has room for the next.
+        // A stream, a deferred reply, or replies backed up, stop the reading until they
+        // are sent.
+        if (conn.holding) {
+            process_requests(conn, ctx);
+        }
+        while (!conn.read_closed && !conn.streaming() && conn.deferred == nullptr && !conn.backed_up() && spent < budget) {
+            iovec space[2];
+            ssize_t len = readv(fd, space, conn.input.free_space(space));
+            if (len > 0) {
+                conn.input.commit(len);
+                process_requests(conn, ctx);
+                spent += len;
+                continue;
+            }
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            if (len == 0) {
+                conn.read_closed = true;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                alive = false;
+            }
+            break;
+        }
+    }
+
+    // A connection waiting for a deferred reply only hears of hangups and errors
+    if (conn.waiting() && (ready & (EPOLLHUP | EPOLLERR))) {
+        alive = false;
+    }
+
+    // Send what is queued, keeping a stream topped up for as long as the socket takes it all
+    while (alive) {
+        if (!has_pending_output(conn)) {
+            if (!has_more(conn) || spent >= budget) {
+                break;
+            }
+            process_requests(conn, ctx);
+            spent += conn.queued();
+        }
+        if (!flush_output(fd, conn, ctx)) {
+            alive = false;
+        } else if (has_pending_output(conn)) {
+            break;  // The socket is full
+        }
+    }
+
+    // Nothing more will arrive, so the connection is done once nothing is left to send
+    if (conn.read_closed && !has_pending_output(conn) && !has_more(conn) && conn.deferred == nullptr) {
+        alive = false;
+    }
+    return alive;
+}
+
+// Connections whose deferred replies were finished while they were parked, handed back to
+// their epoll reactor by the background thread, which wakes it with the eventfd
+struct ReactorWakeup {
+    int fd = eventfd(0, EFD_NONBLOCK);
+    mutex lock;
+    vector<pair<int, shared_ptr<DeferredReply>>> ready;
+
+    ~ReactorWakeup() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    void post(int connection_fd, const shared_ptr<DeferredReply>& deferred) {
+        {
+            lock_guard<mutex> guard(lock);
+            ready.emplace_back(connection_fd, deferred);
+        }
+        uint64_t one = 1;
+        ssize_t written = write(fd, &one, sizeof(one));
+        (void)written;  // Only fails if the counter is already huge, which wakes the reactor anyway
+    }
+};
+
+// Function to serve every client from a single thread with a non-blocking epoll reactor
+int run_epoll_server(int server_fd, const ServerContext& ctx) {
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0 || set_nonblocking(server_fd) < 0) {
+        LOG(LOG_ERROR) << "Error: epoll setup failed";
+        return 1;
+    }
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = server_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) < 0) {
+        LOG(LOG_ERROR) << "Error: epoll setup failed";
+        close(epoll_fd);
+        return 1;
+    }
+
+    shared_ptr<ReactorWakeup> wakeup = make_shared<ReactorWakeup>();
+    struct epoll_event wake_ev = {};
+    wake_ev.events = EPOLLIN;
+    wake_ev.data.fd = wakeup->fd;
+    if (wakeup->fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup->fd, &wake_ev) < 0) {
+        LOG(LOG_ERROR) << "Error: epoll setup failed";
+        close(epoll_fd);
+        return 1;
+    }
+    weak_ptr<ReactorWakeup> wake_target = wakeup;  // Outlived by a reply still being built at shutdown
+
+    unordered_map<int, Connection> connections;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG(LOG_ERROR) << "Error: epoll_wait failed";
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == server_fd) {
+                // Accept every pending connection
+                while (true) {
+                    int client_fd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK);
+                    if (client_fd < 0) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                            LOG(LOG_ERROR) << "Error: Accept failed";
+                        }
+                        break;
+                    }
+
+                    struct epoll_event client_ev = {};
+                    client_ev.events = EPOLLIN | EPOLLRDHUP;
+                    client_ev.data.fd = client_fd;
+                    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &client_ev) < 0) {
+                        close(client_fd);
+                        continue;
+                    }
+
+                    Connection& conn = connections[client_fd];
+                    conn.client_number = ++client_count;
+                    LOG(LOG_DEBUG) << "Client #" << conn.client_number << " connected.";
+                }
+                continue;
+            }
+
+            if (fd == wakeup->fd) {
+                // Deferred replies are ready: their connections wait to be written again,
+                // unless one closed and its fd now belongs to a newer connection
+                uint64_t signals;
+                ssize_t got = read(wakeup->fd, &signals, sizeof(signals));
+                (void)got;
+                vector<pair<int, shared_ptr<DeferredReply>>> woken;
+                {
+                    lock_guard<mutex> guard(wakeup->lock);
+                    woken.swap(wakeup->ready);
                 }
+                for (auto& entry : woken) {
+                    auto found = connections.find(entry.first);
+                    if (found != connections.end() && found->second.deferred == entry.second) {
+                        update_interest(epoll_fd, entry.first, found->second);
+                    }
+                }
+                continue;
+            }
+
+            Connection& conn = connections[fd];
+            bool alive = service_connection(fd, conn, ctx, events[i].events);
+
+            if (!alive) {
+                close_connection(epoll_fd, fd, connections);
+            } else {
+                if (conn.waiting() && !has_pending_output(conn)) {
+                    conn.deferred->park([wake_target, fd](const shared_ptr<DeferredReply>& deferred) {
+                        if (shared_ptr<ReactorWakeup> target = wake_target.lock()) {
+                            target->post(fd, deferred);
+                        }
+                    });
+                }
+                update_interest(epoll_fd, fd, conn);
+            }
+        }
+    }
+
+    close(epoll_fd);
+    return 1;
+}
+
+// Connection served by the worker pool. It travels through the ready queue by pointer,
+// and EPOLLONESHOT guarantees at most one worker holds it at a time.
+struct PoolConnection {
+    int fd;
+    uint32_t ready = 0;  // Events epoll reported for the current turn
+    Connection conn;
+};
+
+// Function to hand a pool connection back to epoll after a turn. One waiting for a
+// deferred reply with nothing left to send is parked instead, and the background thread
+// re-arms it once the reply is ready.
+void rearm_pool_connection(int epoll_fd, PoolConnection* pc) {
+    if (pc->conn.waiting() && !has_pending_output(pc->conn) &&
+        pc->conn.deferred->park([epoll_fd, pc](const shared_ptr<DeferredReply>&) {
+            struct epoll_event rearm = {};
+            rearm.events = EPOLLOUT | EPOLLONESHOT;
+            rearm.data.ptr = pc;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, pc->fd, &rearm);
+        })) {
+        return;
+    }
+
+    struct epoll_event rearm = {};
+    rearm.events = interest_events(pc->conn) | EPOLLONESHOT;
+    rearm.data.ptr = pc;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, pc->fd, &rearm);
+}
+
+// Function to serve clients with a fixed pool of worker threads. One poller thread
+// accepts connections and waits on all of them with epoll; each connection that becomes
+// ready is pushed onto a bounded lock-free queue and some idle worker takes it, reads
+// and answers what it can without blocking, then re-arms it. A connection storm just
+// lengthens the queue (the poller waits while it is full) instead of creating threads.
+int run_pool_server(int server_fd, const ServerContext& ctx, int pool_size, int queue_depth) {
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0 || set_nonblocking(server_fd) < 0) {
+        LOG(LOG_ERROR) << "Error: epoll setup failed";
+        return 1;
+    }
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;  // The listening socket
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) < 0) {
+        LOG(LOG_ERROR) << "Error: epoll setup failed";
+        close(epoll_fd);
+        return 1;
+    }
+
+    MpmcQueue<PoolConnection*> ready(queue_depth);
+    sem_t available;  // Counts the connections pushed and not yet taken
+    sem_init(&available, 0, 0);
+    LOG(LOG_INFO) << "Starting " << pool_size << " pool workers, queue depth " << ready.capacity();
+
+    vector<thread> workers;
+    for (int i = 0; i < pool_size; i++) {
+        workers.push_back(thread([&]() {
+            while (true) {
+                while (sem_wait(&available) < 0 && errno == EINTR) {
+                }
+                PoolConnection* pc;
+                while (!ready.pop(pc)) {
+                    this_thread::yield();  // A push that raised the count is still completing
+                }
+                if (pc == nullptr) {
+                    return;  // The poller is shutting the pool down
+                }
+
+                if (!service_connection(pc->fd, pc->conn, ctx, pc->ready)) {
+                    LOG(LOG_DEBUG) << "Client #" << pc->conn.client_number << " disconnected.";
+                    close(pc->fd);
+                    delete pc;
+                    continue;
+                }
+
+                // Re-arming hands the connection back to the poller, so it is the last use
+                rearm_pool_connection(epoll_fd, pc);
+            }
+        }));
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    size_t reported_depth = 0;  // Queue depth last logged, to report each doubling once
+
+    while (true) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            LOG(LOG_ERROR) << "Error: epoll_wait failed";
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            PoolConnection* pc = (PoolConnection*)events[i].data.ptr;
 
-            if (offset + k >= words.size()) {
-                response += "EOF\n";
-                cout << "Client #" << client_number << ": End of file reached. Sending EOF." << endl;
+            if (pc == nullptr) {
+                // Accept every pending connection
+                while (true) {
+                    int client_fd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK);
+                    if (client_fd < 0) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                            LOG(LOG_ERROR) << "Error: Accept failed";
+                        }
+                        break;
+                    }
+
+                    PoolConnection* accepted = new PoolConnection{client_fd};
+                    accepted->conn.client_number = ++client_count;
+                    struct epoll_event client_ev = {};
+                    client_ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+                    client_ev.data.ptr = accepted;
+                    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &client_ev) < 0) {
+                        close(client_fd);
+                        delete accepted;
+                        continue;
+                    }
+                    LOG(LOG_DEBUG) << "Client #" << accepted->conn.client_number << " connected.";
+                }
+                continue;
             }
 
-            // Send the response
-            send(client_fd, response.c_str(), response.size(), 0);
+            pc->ready = events[i].events;
+            while (!ready.push(pc)) {
+                this_thread::yield();  // Every worker is busy and the queue is full
+            }
+            sem_post(&available);
+
+            size_t depth = ready.size();
+            if (depth >= 2 * max<size_t>(reported_depth, 8)) {
+                reported_depth = depth;
+                LOG(LOG_INFO) << "Pool queue depth: " << depth << " connections waiting for a worker";
+            }
+        }
+    }
+
+    // Stop the workers before their state goes away: each one takes a null connection
+    for (size_t i = 0; i < workers.size(); i++) {
+        while (!ready.push(nullptr)) {
+            this_thread::yield();
+        }
+        sem_post(&available);
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    sem_destroy(&available);
+    close(epoll_fd);
+    return 1;
+}
+
+// Function to serve clients with a fixed set of workers scheduled by work stealing. All
+// workers wait on one epoll instance with EPOLLONESHOT, so each ready connection is
+// reported to exactly one of them. A worker moves up to STEAL_BATCH ready connections
+// into its own deque and serves them newest first; a worker that runs out steals the
+// oldest from the others before waiting on epoll again. Workers already blocked in
+// epoll_wait would never look, so a worker left holding more than one connection
+// signals an eventfd, also one-shot in the same epoll, which wakes exactly one of them
+// to steal; a thief that leaves work behind passes the signal on. Nobody is signalled
+// while every worker is busy. A burst that lands on one
+// worker so spreads to idle ones without any shared queue. Each turn is capped at
+// TURN_BUDGET bytes, after which the connection is re-armed and, being still ready,
+// goes back behind the others, so a client streaming the whole file gets its share
+// without holding up clients that want one reply.
+int run_steal_server(int server_fd, const ServerContext& ctx, int pool_size) {
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0 || set_nonblocking(server_fd) < 0) {
+        LOG(LOG_ERROR) << "Error: epoll setup failed";
+        return 1;
+    }
+
+    // The listener is one-shot too, so one worker at a time accepts
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) < 0) {
+        LOG(LOG_ERROR) << "Error: epoll setup failed";
+        close(epoll_fd);
+        return 1;
+    }
+
+    // Counter a worker bumps to wake one blocked peer to steal, and the number of workers
+    // that are out of work (stealing or blocked in epoll_wait)
+    int wake_fd = eventfd(0, EFD_NONBLOCK);
+    atomic<int> idle{0};
+    struct epoll_event wake_ev = {};
+    wake_ev.events = EPOLLIN | EPOLLONESHOT;
+    wake_ev.data.ptr = &wake_fd;
+    if (wake_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &wake_ev) < 0) {
+        LOG(LOG_ERROR) << "Error: epoll setup failed";
+        close(epoll_fd);
+        return 1;
+    }
+    auto wake_peer = [&]() {
+        if (idle.load() == 0) {
+            return;  // An idle worker checks the deques before it blocks
         }
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;  // Only fails if the counter is already huge, which wakes a peer anyway
+    };
 
-        // Clear the buffer for the next iteration
-        memset(buffer, 0, BUFFER_SIZE);  
+    vector<unique_ptr<WorkStealingDeque<PoolConnection*>>> deques;
+    for (int i = 0; i < pool_size; i++) {
+        deques.emplace_back(new WorkStealingDeque<PoolConnection*>(STEAL_BATCH));
     }
+    LOG(LOG_INFO) << "Starting " << pool_size << " work-stealing workers";
 
-    cout << "Client #" << client_number << " disconnected." << endl;
-    close(client_fd);
+    auto accept_all = [&]() {
+        while (true) {
+            int client_fd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK);
+            if (client_fd < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    LOG(LOG_ERROR) << "Error: Accept failed";
+                }
+                break;
+            }
+
+            PoolConnection* accepted = new PoolConnection{client_fd};
+            accepted->conn.client_number = ++client_count;
+            struct epoll_event client_ev = {};
+            client_ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+            client_ev.data.ptr = accepted;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &client_ev) < 0) {
+                close(client_fd);
+                delete accepted;
+                continue;
+            }
+            LOG(LOG_DEBUG) << "Client #" << accepted->conn.client_number << " connected.";
+        }
+
+        struct epoll_event rearm = {};
+        rearm.events = EPOLLIN | EPOLLONESHOT;
+        rearm.data.ptr = nullptr;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, server_fd, &rearm);
+    };
+
+    auto serve = [&](PoolConnection* pc) {
+        if (!service_connection(pc->fd, pc->conn, ctx, pc->ready, TURN_BUDGET)) {
+            LOG(LOG_DEBUG) << "Client #" << pc->conn.client_number << " disconnected.";
+            close(pc->fd);
+            delete pc;
+            return;
+        }
+
+        // Re-arming hands the connection back to epoll, so it is the last use
+        rearm_pool_connection(epoll_fd, pc);
+    };
+
+    vector<thread> workers;
+    for (int self = 0; self < pool_size; self++) {
+        workers.push_back(thread([&, self]() {
+            WorkStealingDeque<PoolConnection*>& own = *deques[self];
+            struct epoll_event events[STEAL_BATCH];
+            PoolConnection* pc;
+
+            while (true) {
+                if (own.pop(pc)) {
+                    serve(pc);
+                    continue;
+                }
+
+                // Out of work: try every other worker once, starting with the next one
+                idle++;
+                bool stolen = false;
+                int victim = self;
+                for (int i = 1; i < pool_size && !stolen; i++) {
+                    victim = (self + i) % pool_size;
+                    stolen = deques[victim]->steal(pc);
+                }
+                if (stolen) {
+                    idle--;
+                    if (deques[victim]->size() > 0) {
+                        wake_peer();  // Leave the rest to the next idle worker
+                    }
+                    serve(pc);
+                    continue;
+                }
+
+                int n = epoll_wait(epoll_fd, events, STEAL_BATCH, -1);
+                idle--;
+                if (n < 0) {
+                    if (errno != EINTR) {
+                        LOG(LOG_ERROR) << "Error: epoll_wait failed";
+                        return;
+                    }
+                    continue;
+                }
+                int taken = 0;
+                for (int i = 0; i < n; i++) {
+                    if (events[i].data.ptr == &wake_fd) {
+                        // Woken to steal: reset the counter and let the next signal through
+                        uint64_t signals;
+                        ssize_t got = read(wake_fd, &signals, sizeof(signals));
+                        (void)got;
+                        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, wake_fd, &wake_ev);
+                        continue;
+                    }
+                    pc = (PoolConnection*)events[i].data.ptr;
+                    if (pc == nullptr) {
+                        accept_all();
+                        continue;
+                    }
+                    pc->ready = events[i].events;
+                    if (!own.push(pc)) {
+                        serve(pc);  // Cannot happen with STEAL_BATCH slots, but never drop one
+                        continue;
+                    }
+                    taken++;
+                }
+                if (taken > 1) {
+                    wake_peer();
+                }
+            }
+        }));
+    }
+
+    for (auto& t : workers) {
+        t.join();
+    }
+    close(wake_fd);
+    close(epoll_fd);
+    return 1;
+}
+
+#ifdef HAVE_LIBURING
+// Per-connection state kept by the io_uring backend. Replies are appended to conn.output
+// while the previous batch is being sent from inflight, so the buffer handed to the
+// kernel never moves and at most one send per connection is in flight, which keeps
+// the replies in order. A multishot recv keeps completing whatever happens to the
+// replies, so a client that falls behind has its recv cancelled (paused) until they
+// drain, like the epoll reactor stops reading.
+struct UringConnection {
+    Connection conn;
+    string inflight;           // Bytes owned by the send currently in flight
+    size_t inflight_sent = 0;
+    string backlog;            // Received bytes held back while a stream or backed up replies are sent
+    bool receiving = true;     // The multishot recv is still armed
+    bool paused = false;       // The recv is being held off until the replies drain
+    bool ended = false;        // The peer closed or failed; no recv is armed again
+    bool sending = false;
+};
+
+// Kinds of completion, stored in the top bits of user_data next to the fd
+enum UringOp : uint64_t { URING_ACCEPT = 1, URING_RECV = 2, URING_SEND = 3, URING_CANCEL = 4 };
+
+inline uint64_t uring_tag(UringOp op, int fd) {
+    return (uint64_t)op << 32 | (uint32_t)fd;
+}
+
+// Function to get a free submission entry, submitting the queued ones if the ring is full
+io_uring_sqe* uring_sqe(io_uring* ring) {
+    io_uring_sqe* sqe = io_uring_get_sqe(ring);
+    if (sqe == nullptr) {
+        io_uring_submit(ring);
+        sqe = io_uring_get_sqe(ring);
+    }
+    return sqe;
+}
+
+void uring_arm_accept(io_uring* ring, int server_fd) {
+    io_uring_sqe* sqe = uring_sqe(ring);
+    io_uring_prep_multishot_accept(sqe, server_fd, NULL, NULL, 0);
+    io_uring_sqe_set_data64(sqe, uring_tag(URING_ACCEPT, server_fd));
+}
+
+// Function to arm a multishot recv that picks its buffers from the provided buffer ring
+void uring_arm_recv(io_uring* ring, int fd) {
+    io_uring_sqe* sqe = uring_sqe(ring);
+    io_uring_prep_recv_multishot(sqe, fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    io_uring_sqe_set_data64(sqe, uring_tag(URING_RECV, fd));
+}
+
+// Function to tell whether a connection has more than MAX_PENDING_OUTPUT bytes of replies
+// waiting or in flight, or of requests held back
+bool uring_backed_up(const UringConnection& uc) {
+    size_t replies = uc.conn.queued() + uc.inflight.size() - uc.inflight_sent;
+    return replies > MAX_PENDING_OUTPUT || uc.backlog.size() > MAX_PENDING_OUTPUT;
+}
+
+// Function to pause the connection's recv while it is backed up, and re-arm it once it
+// has drained. A recv still armed is cancelled; its last completion re-arms it if the
+// connection drained in the meantime.
+void uring_update_recv(io_uring* ring, int fd, UringConnection& uc) {
+    if (uc.ended) {
+        return;
+    }
+    bool backed_up = uring_backed_up(uc);
+    if (backed_up && !uc.paused) {
+        uc.paused = true;
+        if (uc.receiving) {
+            io_uring_sqe* sqe = uring_sqe(ring);
+            io_uring_prep_cancel64(sqe, uring_tag(URING_RECV, fd), 0);
+            io_uring_sqe_set_data64(sqe, uring_tag(URING_CANCEL, fd));
+        }
+    } else if (!backed_up && uc.paused) {
+        uc.paused = false;
+        if (!uc.receiving) {
+            uring_arm_recv(ring, fd);
+            uc.receiving = true;
+        }
+    }
+}
+
+// Function to frame received bytes and answer them; returns how many were taken. A stream
+// or replies backed up stop the taking, since the requests must wait until they are sent.
+size_t uring_frame(Connection& conn, const ServerContext& ctx, const char* bytes, size_t length) {
+    size_t taken = 0;
+    do {
+        taken += conn.input.fill(bytes + taken, length - taken);
+        process_requests(conn, ctx);
+    } while (taken < length && !conn.streaming() && !conn.backed_up());
+    return taken;
+}
+
+// Function to send the rest of the in-flight batch, or start sending the queued output,
+// topping a stream up first and taking in the held back requests once it is done
+void uring_send(io_uring* ring, int fd, UringConnection& uc, const ServerContext& ctx) {
+    if (uc.inflight_sent == uc.inflight.size()) {
+        if (uc.conn.output.empty() && (uc.conn.streaming() || uc.conn.holding)) {
+            process_requests(uc.conn, ctx);
+        }
+        if (!uc.conn.streaming() && !uc.conn.backed_up() && !uc.backlog.empty()) {
+            uc.backlog.erase(0, uring_frame(uc.conn, ctx, uc.backlog.data(), uc.backlog.size()));
+        }
+        if (uc.conn.output.empty()) {
+            return;
+        }
+        uc.inflight.clear();
+        uc.inflight.swap(uc.conn.output);
+        uc.inflight_sent = 0;
+    }
+
+    io_uring_sqe* sqe = uring_sqe(ring);
+    io_uring_prep_send(sqe, fd, uc.inflight.data() + uc.inflight_sent,
+                       uc.inflight.size() - uc.inflight_sent, MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe, uring_tag(URING_SEND, fd));
+    uc.sending = true;
+}
+
+// Function to serve every client from a single thread through io_uring: one multishot
+// accept, one multishot recv per connection filling buffers from a shared provided
+// buffer ring, and sends queued in the same submission as the recv completions that
+// produced them, so under load a single io_uring_enter covers many requests
+int run_uring_server(int server_fd, const ServerContext& ctx) {
+    io_uring ring;
+    int ret = io_uring_queue_init(URING_ENTRIES, &ring, 0);
+    if (ret < 0) {
+        LOG(LOG_ERROR) << "Error: io_uring setup failed: " << strerror(-ret);
+        return 1;
+    }
+
+    // Register the receive buffers with the kernel, which picks one per completion
+    vector<char> buffers((size_t)URING_BUFFERS * BUFFER_SIZE);
+    io_uring_buf_ring* buf_ring = io_uring_setup_buf_ring(&ring, URING_BUFFERS, URING_BUFFER_GROUP, 0, &ret);
+    if (buf_ring == nullptr) {
+        LOG(LOG_ERROR) << "Error: io_uring buffer ring setup failed: " << strerror(-ret);
+        io_uring_queue_exit(&ring);
+        return 1;
+    }
+    int mask = io_uring_buf_ring_mask(URING_BUFFERS);
+    for (int i = 0; i < URING_BUFFERS; i++) {
+        io_uring_buf_ring_add(buf_ring, &buffers[(size_t)i * BUFFER_SIZE], BUFFER_SIZE, i, mask, i);
+    }
+    io_uring_buf_ring_advance(buf_ring, URING_BUFFERS);
+
+    unordered_map<int, UringConnection> connections;
+    uring_arm_accept(&ring, server_fd);
+
+    while (true) {
+        ret = io_uring_submit_and_wait(&ring, 1);
+        if (ret < 0 && ret != -EINTR) {
+            LOG(LOG_ERROR) << "Error: io_uring_submit_and_wait failed: " << strerror(-ret);
+            break;
+        }
+
+        io_uring_cqe* cqe;
+        unsigned head, seen = 0;
+        io_uring_for_each_cqe(&ring, head, cqe) {
+            seen++;
+            UringOp op = (UringOp)(cqe->user_data >> 32);
+            int fd = (int)(uint32_t)cqe->user_data;
+            bool more = cqe->flags & IORING_CQE_F_MORE;
+
+            if (op == URING_ACCEPT) {
+                if (cqe->res >= 0) {
+                    UringConnection& uc = connections[cqe->res];
+                    uc.conn.client_number = ++client_count;
+                    LOG(LOG_DEBUG) << "Client #" << uc.conn.client_number << " connected.";
+                    uring_arm_recv(&ring, cqe->res);
+                } else {
+                    LOG(LOG_ERROR) << "Error: Accept failed";
+                }
+                if (!more) {
+                    uring_arm_accept(&ring, server_fd);
+                }
+                continue;
+            }
+
+            if (op == URING_CANCEL) {
+                continue;  // The recv's own last completion says how it ended
+            }
+
+            UringConnection& uc = connections[fd];
+            if (op == URING_RECV) {
+                if (cqe->res > 0) {
+                    // Frame the request bytes as they are copied out, then hand the buffer
+                    // straight back
+                    int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                    char* buffer = &buffers[(size_t)bid * BUFFER_SIZE];
+                    if (uc.backlog.empty()) {
+                        size_t taken = uring_frame(uc.conn, ctx, buffer, cqe->res);
+                        uc.backlog.append(buffer + taken, cqe->res - taken);
+                    } else {
+                        uc.backlog.append(buffer, cqe->res);
+                    }
+                    io_uring_buf_ring_add(buf_ring, buffer, BUFFER_SIZE, bid, mask, 0);
+                    io_uring_buf_ring_advance(buf_ring, 1);
+
+                    if (!uc.sending) {
+                        uring_send(&ring, fd, uc, ctx);
+                    }
+                }
+                if (!more) {
+                    // Running out of buffers or a cancel for backpressure only interrupts
+                    // the recv; EOF and errors end it
+                    uc.receiving = false;
+                    if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED)) {
+                        uc.ended = true;
+                    } else if (!uc.paused && !uc.ended) {
+                        uring_arm_recv(&ring, fd);
+                        uc.receiving = true;
+                    }
+                }
+                uring_update_recv(&ring, fd, uc);
+            } else if (op == URING_SEND) {
+                uc.sending = false;
+                if (cqe->res > 0) {
+                    uc.inflight_sent += cqe->res;
+                    uring_send(&ring, fd, uc, ctx);
+                } else if (cqe->res != -EINTR && cqe->res != -EAGAIN) {
+                    // The peer is gone; drop what is queued and let the recv wind down
+                    uc.inflight.clear();
+                    uc.inflight_sent = 0;
+                    uc.conn.output.clear();
+                    uc.conn.stream_next = -1;
+                    uc.backlog.clear();
+                    uc.ended = true;
+                    shutdown(fd, SHUT_RDWR);
+                } else {
+                    uring_send(&ring, fd, uc, ctx);
+                }
+                uring_update_recv(&ring, fd, uc);
+            }
+
+            // Nothing refers to the connection once its recv has ended for good and no
+            // send is in flight
+            if (uc.ended && !uc.receiving && !uc.sending) {
+                LOG(LOG_DEBUG) << "Client #" << uc.conn.client_number << " disconnected.";
+                close(fd);
+                connections.erase(fd);
+            }
+        }
+        io_uring_cq_advance(&ring, seen);
+    }
+
+    io_uring_free_buf_ring(&ring, buf_ring, URING_BUFFERS, URING_BUFFER_GROUP);
+    io_uring_queue_exit(&ring);
+    return 1;
 }
+#endif
 
 int main() {
+    // A client that resets its connection mid-reply must not kill the server: with
+    // SIGPIPE ignored, send, writev and sendfile fail with EPIPE and only that client ends
+    signal(SIGPIPE, SIG_IGN);
+
     // Load config from config.json using nlohmann::json
     ifstream config_file("config.json");
     if (!config_file.is_open()) {
-        cerr << "Error: Unable to open config.json" << endl;
+        LOG(LOG_ERROR) << "Error: Unable to open config.json";
         return 1;
     }
 
@@ -104,65 +1845,179 @@ int main() {
     string filename = config["input_file"];
     int p = config["p"];
     int k = config["k"];
+    string server_mode = config.value("server_mode", "thread");  // "thread", "pool", "steal", "epoll", "reuseport" or "io_uring"
 
-    // Log server configuration
-    cout << "Starting server on port " << port << endl;
-    cout << "Serving file: " << filename << endl;
-    cout << "Config: k = " << k << ", p = " << p << endl;
-
-    // Read the file and split it into words
-    ifstream file(filename);
-    if (!file.is_open()) {
-        cerr << "Error: Unable to open file " << filename << endl;
+    // Per-request lines are logged at "debug"; the default "info" keeps them off the hot path
+    string log_level = config.value("log_level", "info");
+    LogLevel level;
+    if (!Logger::parse_level(log_level, level)) {
+        LOG(LOG_ERROR) << "Error: Unknown log_level " << log_level << " (use error, warn, info or debug)";
         return 1;
     }
+    Logger::set_level(level);
 
-    string file_content((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
-    vector<string> words = split_words(file_content);
-    cout << "File read successfully, total words: " << words.size() << endl;
+    // Log server configuration
+    LOG(LOG_INFO) << "Starting server on port " << port;
+    LOG(LOG_INFO) << "Serving file: " << filename;
+    LOG(LOG_INFO) << "Config: k = " << k << ", p = " << p << ", mode = " << server_mode;
 
-    // Setup TCP socket
-    int server_fd, client_fd;
-    struct sockaddr_in server_addr;
+    // Map the file and index its words
+    shared_ptr<Corpus> corpus = make_shared<Corpus>();
+    if (!corpus->load(filename)) {
+        LOG(LOG_ERROR) << "Error: Unable to open file " << filename;
+        return 1;
+    }
+    SharedWords words = corpus;
+    LOG(LOG_INFO) << "File read successfully, total words: " << words->size();
 
-    // Create socket
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        cerr << "Error: Socket creation failed" << endl;
+#ifndef HAVE_LIBURING
+    if (server_mode == "io_uring") {
+        LOG(LOG_ERROR) << "Error: This server was built without liburing; io_uring mode is unavailable";
         return 1;
     }
+#endif
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port);
+    // Requests may ask for their own word count up to max_count (never less than k)
+    int max_count = max(k, config.value("max_count", 100000));
+    ServerContext ctx = {words, k, p, max_count};
 
-    // Bind socket
-    if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        cerr << "Error: Binding failed" << endl;
+    // Count the whole file once, in parallel, so FREQ requests for it are a copy
+    int frequency_threads = max(1u, thread::hardware_concurrency());
+    ctx.frequency_threads = frequency_threads;
+    ctx.frequencies = make_shared<const string>(frequency_reply(count_words(*words, 0, words->size(), frequency_threads)));
+    LOG(LOG_INFO) << "Word frequencies counted: " << ctx.frequencies->size() << " bytes";
+
+    // Intern the words for the ID protocol. It is off by default, since it costs 4 bytes a
+    // word and more load time; a client asking for it anyway is refused like an older
+    // server would.
+    bool id_protocol = config.value("id_protocol", false);
+    if (id_protocol) {
+        shared_ptr<WordDictionary> dictionary = make_shared<WordDictionary>();
+        dictionary->build(*words, frequency_threads);
+        ctx.dictionary = dictionary;
+        ctx.id_greeting = make_shared<const string>(ID_ACK + dictionary_reply(*dictionary));
+        LOG(LOG_INFO) << "Dictionary built: " << dictionary->size() << " distinct words";
+    }
+
+    // Index every word's offsets, on the same IDs, so COUNT requests take two binary
+    // searches instead of a scan. range_index builds it now; otherwise the first COUNT does.
+    ctx.index = make_shared<RangeIndex>(words, ctx.dictionary, frequency_threads);
+    if (config.value("range_index", false)) {
+        ctx.index->get();
+    }
+
+    // The reactor modes build slow replies (a COUNT that must build the index first, a FREQ
+    // over part of the file) on a background thread instead of stalling every connection they serve. It is declared
+    // after ctx, so it stops before the state its jobs use goes away.
+    unique_ptr<BackgroundWork> background;
+    if (server_mode == "epoll" || server_mode == "reuseport" || server_mode == "pool" || server_mode == "steal") {
+        background.reset(new BackgroundWork());
+        ctx.background = background.get();
+    }
+
+    // A spill file implies the response cache, since it is a copy of it on disk
+    string spill_file = config.value("spill_file", "");
+    if (server_mode == "io_uring" && !spill_file.empty()) {
+        LOG(LOG_INFO) << "spill_file is not used in io_uring mode, serving the cache from memory";
+        spill_file = "";
+    }
+    // Compressed frames of the cached replies are made from the cache, so they imply it too
+    bool compressed_cache = config.value("compressed_cache", false);
+    if (config.value("response_cache", false) || !spill_file.empty() || compressed_cache) {
+        ctx.cache = build_response_cache(*words, k, p, spill_file);
+        LOG(LOG_INFO) << "Response cache built: " << ctx.cache->wire.size() << " bytes for "
+             << ctx.cache->starts.size() - 1 << " offsets"
+             << (ctx.cache->spill_fd >= 0 ? ", served with sendfile" : "");
+    }
+    if (compressed_cache) {
+        ctx.compressed_cache = build_compressed_cache(*ctx.cache);
+        LOG(LOG_INFO) << "Compressed cache built: " << ctx.compressed_cache->wire.size() << " bytes";
+    }
+
+    // In reuseport mode every worker reactor gets its own listening socket on the same port
+    int num_workers = 1;
+    if (server_mode == "reuseport") {
+        num_workers = config.value("num_workers", 0);
+        if (num_workers <= 0) {
+            num_workers = max(1u, thread::hardware_concurrency());
+        }
+    }
+
+    vector<int> listen_fds;
+    for (int i = 0; i < num_workers; i++) {
+        int fd = open_listener(port, server_mode == "reuseport");
+        if (fd < 0) {
+            for (int open_fd : listen_fds) {
+                close(open_fd);
+            }
+            return 1;
+        }
+        listen_fds.push_back(fd);
+    }
+    int server_fd = listen_fds[0], client_fd;
+    LOG(LOG_INFO) << "Server is listening on port " << port;
+
+    if (server_mode == "pool" || server_mode == "steal") {
+        // A fixed number of workers, by default one per core, take ready connections
+        // from a bounded queue, or in steal mode from their own deques and each other's
+        int pool_size = config.value("pool_size", 0);
+        if (pool_size <= 0) {
+            pool_size = max(1u, thread::hardware_concurrency());
+        }
+        int queue_depth = max(1, config.value("pool_queue_depth", 1024));
+        raise_fd_limit();
+        int status = server_mode == "pool" ? run_pool_server(server_fd, ctx, pool_size, queue_depth)
+                                           : run_steal_server(server_fd, ctx, pool_size);
         close(server_fd);
-        return 1;
+        return status;
     }
 
-    // Start listening
-    if (listen(server_fd, 10) < 0) {
-        cerr << "Error: Listening failed" << endl;
+    if (server_mode == "epoll") {
+        raise_fd_limit();
+        int status = run_epoll_server(server_fd, ctx);
         close(server_fd);
+        return status;
+    }
+
+#ifdef HAVE_LIBURING
+    if (server_mode == "io_uring") {
+        raise_fd_limit();
+        int status = run_uring_server(server_fd, ctx);
+        close(server_fd);
+        return status;
+    }
+#endif
+
+    if (server_mode == "reuseport") {
+        // The kernel spreads incoming connections across the workers' sockets;
+        // all workers read the same corpus
+        raise_fd_limit();
+        LOG(LOG_INFO) << "Starting " << num_workers << " worker reactors";
+        vector<thread> workers;
+        for (int fd : listen_fds) {
+            workers.push_back(thread([fd, &ctx]() {
+                run_epoll_server(fd, ctx);
+                close(fd);
+            }));
+        }
+        for (auto &t : workers) {
+            t.join();
+        }
         return 1;
     }
-    cout << "Server is listening on port " << port << endl;
 
     while (true) {
         // Accept connection from client
         client_fd = accept(server_fd, NULL, NULL);
         if (client_fd < 0) {
-            cerr << "Error: Accept failed" << endl;
+            LOG(LOG_ERROR) << "Error: Accept failed";
             continue;
         }
         
         int client_number = ++client_count;  // Increment and get client number
         
-        // Spawn a new thread to handle each client
-        thread client_thread(handle_client, client_fd, words, k, p, client_number);
+        // Spawn a new thread to handle each client; only the shared pointer is copied
+        thread client_thread(handle_client, client_fd, ctx, client_number);
         client_thread.detach();  // Detach thread to allow concurrent handling
     }
 
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <sys/uio.h>
+#include "corpus.hpp"
+
+// Function to describe the reply for one offset as a list of buffers: k words starting
+// at offset, a newline after every p words, EOF once the end of the file is reached, $$
+// past the end. With capped set (the request asked for more than max_count words) a
+// reply that is not the last ends with the line CAPPED instead, so a client stepping
+// offsets by what it asked for knows it missed words. Words are referenced in place in
+// the corpus, so nothing is copied and the whole reply can leave in one writev.
+inline void gather_response(std::vector<iovec>& iov, const Corpus& words, int offset, int k, int p, bool capped = false) {
+    if (offset < 0 || offset >= words.size()) {
+        iov.push_back({(void*)"$$\n", 3});
+        return;
+    }
+
+    size_t end = std::min<size_t>((size_t)offset + k, words.size());
+    for (size_t first = offset; first < end; first += p) {
+        size_t last = std::min<size_t>(first + p, end);
+        std::string_view run = words.run(first, last);
+        iov.push_back({(void*)run.data(), run.size()});
+        if (!words.comma_after(last - 1)) {
+            iov.push_back({(void*)",", 1});
+        }
+        if (last - first == p) {
+            iov.push_back({(void*)"\n", 1});  // Add a newline after p words
+        }
+    }
+
+    if ((size_t)offset + k >= words.size()) {
+        iov.push_back({(void*)"EOF\n", 4});
+    } else if (capped) {
+        iov.push_back({(void*)"CAPPED\n", 7});
+    }
+}
+
+// Function to append the reply for one offset, byte for byte what gather_response describes
+inline void append_response(std::string& response, const Corpus& words, int offset, int k, int p, bool capped = false) {
+    std::vector<iovec> iov;
+    gather_response(iov, words, offset, k, p, capped);
+    for (const iovec& part : iov) {
+        response.append((const char*)part.iov_base, part.iov_len);
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include "corpus.hpp"
+#include "frequency.hpp"
+#include "word_table.hpp"
+
+// Dictionary encoding of the corpus: every distinct word, normalized like the clients
+// count it, is interned once and numbered in order of first appearance, and the corpus
+// becomes one uint32_t ID per word. A word that normalizes to nothing (only whitespace)
+// still gets an ID, the empty word's, so offset i of the corpus is always ids[i]. The
+// repetitive word files hold a few dozen distinct words, so a reply of IDs is 4 bytes a
+// word whatever the words are, and a client can count into a flat array by ID.
+class WordDictionary {
+public:
+    // Function to intern every word of the corpus with up to threads threads. Each slice
+    // of the corpus numbers its own distinct words in order of first appearance; the
+    // slices' words are then numbered in slice order, which gives the IDs a single pass
+    // would, and each slice rewrites its numbers as those IDs. Words are looked up as
+    // string_views, so only a word seen for the first time is copied.
+    void build(const Corpus& words, int threads = 1) {
+        size_t total = words.size();
+        size_t slices = std::max<size_t>(1, std::min<size_t>(threads, total / FREQUENCY_SLICE));
+        ids.resize(total);
+
+        std::vector<WordTable> local(slices);
+        std::vector<std::vector<std::string_view>> firsts(slices);  // Each slice's words by local number
+        std::vector<std::vector<uint32_t>> global(slices);          // Each slice's local number to ID
+        auto in_slices = [&](auto work) {
+            std::vector<std::thread> workers;
+            for (size_t s = 0; s < slices; s++) {
+                size_t begin = total * s / slices, end = total * (s + 1) / slices;
+                if (slices == 1) {
+                    work(s, begin, end);
+                } else {
+                    workers.push_back(std::thread(work, s, begin, end));
+                }
+            }
+            for (auto& t : workers) {
+                t.join();
+            }
+        };
+
+        in_slices([&](size_t s, size_t begin, size_t end) {
+            std::string scratch;
+            for (size_t i = begin; i < end; i++) {
+                std::string_view word = normalize_word(words[i], scratch);
+                uint64_t number;
+                if (!local[s].find(word, number)) {
+                    number = firsts[s].size();
+                    firsts[s].push_back(local[s].add(word, number));
+                }
+                ids[i] = (uint32_t)number;
+            }
+        });
+
+        for (size_t s = 0; s < slices; s++) {
+            for (std::string_view word : firsts[s]) {
+                uint64_t id;
+                if (!numbers.find(word, id)) {
+                    id = spellings.size();
+                    spellings.push_back(numbers.add(word, id));  // The table's copy never moves
+                }
+                global[s].push_back((uint32_t)id);
+            }
+        }
+
+        in_slices([&](size_t s, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                ids[i] = global[s][ids[i]];
+            }
+        });
+    }
+
+    // Number of distinct words
+    size_t size() const {
+        return spellings.size();
+    }
+
+    std::string_view word(uint32_t id) const {
+        return spellings[id];
+    }
+
+    // Function to find the ID of word; false if the corpus does not hold it
+    bool find(std::string_view word, uint32_t& id) const {
+        uint64_t number;
+        if (!numbers.find(word, number)) {
+            return false;
+        }
+        id = (uint32_t)number;
+        return true;
+    }
+
+    // The corpus as IDs, one per word
+    const std::vector<uint32_t>& encoded() const {
+        return ids;
+    }
+
+private:
+    WordTable numbers;                      // Word to its ID, kept where a WordTable keeps a count
+    std::vector<std::string_view> spellings;  // ID to its word, viewing the copies in numbers
+    std::vector<uint32_t> ids;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "word_dictionary.hpp"
+
+// Positional index of the corpus for range-count queries ("how often does word W occur
+// at offsets [first, last)"). Every word of the dictionary gets the sorted list of
+// offsets it occurs at; the lists are laid end to end in one array, ID by ID, so the
+// index is one uint32_t per corpus word on top of the dictionary. A query is two binary
+// searches in one word's list, O(log n), however wide the range.
+class WordIndex {
+public:
+    // Function to index the dictionary-encoded corpus: one pass to count each ID, one to
+    // place each offset in its ID's list. Offsets are placed in corpus order, so every
+    // list comes out sorted. dictionary must outlive the index.
+    void build(const WordDictionary& dictionary) {
+        this->dictionary = &dictionary;
+        const std::vector<uint32_t>& ids = dictionary.encoded();
+
+        starts.assign(dictionary.size() + 1, 0);
+        for (uint32_t id : ids) {
+            starts[id + 1]++;
+        }
+        for (size_t id = 0; id < dictionary.size(); id++) {
+            starts[id + 1] += starts[id];
+        }
+        offsets.resize(ids.size());
+        std::vector<uint32_t> next(starts.begin(), starts.end() - 1);
+        for (size_t i = 0; i < ids.size(); i++) {
+            offsets[next[ids[i]]++] = (uint32_t)i;
+        }
+    }
+
+    // Function to count the occurrences of word at offsets [first, last); 0 for a word the
+    // corpus does not hold or an empty range
+    uint64_t count(std::string_view word, size_t first, size_t last) const {
+        uint32_t id;
+        if (!dictionary->find(word, id) || first >= last) {
+            return 0;
+        }
+        const uint32_t* begin = offsets.data() + starts[id];
+        const uint32_t* end = offsets.data() + starts[id + 1];
+        return std::lower_bound(begin, end, last) - std::lower_bound(begin, end, first);
+    }
+
+    // Bytes held by the offset lists and their bounds, not counting the dictionary
+    size_t list_bytes() const {
+        return (offsets.size() + starts.size()) * sizeof(uint32_t);
+    }
+
+private:
+    const WordDictionary* dictionary = nullptr;
+    std::vector<uint32_t> starts;   // ID's offsets are offsets[starts[id], starts[id + 1])
+    std::vector<uint32_t> offsets;  // Every word's sorted offsets, ID after ID
+};
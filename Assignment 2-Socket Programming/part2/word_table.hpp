@@ -0,0 +1,198 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// Bump allocator that owns the bytes of every distinct word a WordTable has seen. Words are
+// copied into large blocks that are never moved or freed before the arena, so the
+// string_views handed out stay valid for its whole life.
+class Arena {
+public:
+    // Function to copy word into the arena and return a view of the copy
+    std::string_view store(std::string_view word) {
+        if (word.size() > left || next == nullptr) {  // Even an empty word gets a non-null view
+            size_t size = std::max(BLOCK_SIZE, word.size());
+            blocks.emplace_back(new char[size]);
+            next = blocks.back().get();
+            left = size;
+        }
+        memcpy(next, word.data(), word.size());
+        std::string_view copy(next, word.size());
+        next += word.size();
+        left -= word.size();
+        return copy;
+    }
+
+private:
+    static constexpr size_t BLOCK_SIZE = 1 << 20;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char* next = nullptr;
+    size_t left = 0;
+};
+
+// Word frequency table: open addressing with linear probing, keyed by string_views into an
+// Arena. Counting a word already in the table is one hash and usually one probe, with no
+// allocation; only a new word is copied, into the arena. The table is kept at most half
+// full and doubles when it gets there. Words come out in order only through sorted().
+class WordTable {
+public:
+    explicit WordTable(size_t capacity = 1024) : slots(round_up(capacity)), mask(slots.size() - 1) {}
+
+    // Function to add times occurrences of word; returns the table's own copy of word, which
+    // stays valid as long as the table
+    std::string_view add(std::string_view word, uint64_t times = 1) {
+        uint64_t hash = hash_word(word);
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            Slot& slot = slots[i];
+            if (slot.word.data() == nullptr) {
+                std::string_view stored = slot.word = arena.store(word);
+                slot.hash = hash;
+                slot.count = times;
+                if (++used * 2 > slots.size()) {
+                    grow();
+                }
+                return stored;
+            }
+            if (slot.hash == hash && slot.word == word) {
+                slot.count += times;
+                return slot.word;
+            }
+        }
+    }
+
+    // Function to look up the count of word without adding it; false if the table does not
+    // hold word
+    bool find(std::string_view word, uint64_t& count) const {
+        uint64_t hash = hash_word(word);
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            const Slot& slot = slots[i];
+            if (slot.word.data() == nullptr) {
+                return false;
+            }
+            if (slot.hash == hash && slot.word == word) {
+                count = slot.count;
+                return true;
+            }
+        }
+    }
+
+    // Function to add every count of other to this table
+    void merge(const WordTable& other) {
+        for (const Slot& slot : other.slots) {
+            if (slot.word.data() != nullptr) {
+                add(slot.word, slot.count);
+            }
+        }
+    }
+
+    // Number of distinct words
+    size_t size() const {
+        return used;
+    }
+
+    // Function to list every word with its count, sorted by word like a std::map would
+    std::vector<std::pair<std::string_view, uint64_t>> sorted() const {
+        std::vector<std::pair<std::string_view, uint64_t>> entries;
+        entries.reserve(used);
+        for (const Slot& slot : slots) {
+            if (slot.word.data() != nullptr) {
+                entries.emplace_back(slot.word, slot.count);
+            }
+        }
+        std::sort(entries.begin(), entries.end());
+        return entries;
+    }
+
+private:
+    struct Slot {
+        std::string_view word;  // Empty slot while data() is null
+        uint64_t hash = 0;
+        uint64_t count = 0;
+    };
+
+    static size_t round_up(size_t capacity) {
+        size_t size = 16;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    // Function to hash a word eight bytes at a time, finishing with a multiply-xorshift so
+    // the low bits used to pick a slot depend on every byte
+    static uint64_t hash_word(std::string_view word) {
+        const uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+        uint64_t hash = word.size() * multiplier;
+        size_t i = 0;
+        for (; i + 8 <= word.size(); i += 8) {
+            uint64_t chunk;
+            memcpy(&chunk, word.data() + i, 8);
+            hash = (hash ^ chunk) * multiplier;
+            hash ^= hash >> 32;
+        }
+        // The last 1-7 bytes are read with fixed-size loads, which may overlap, instead of
+        // a variable-length copy; the length is already mixed in
+        size_t rest = word.size() - i;
+        const unsigned char* tail = (const unsigned char*)word.data() + i;
+        if (rest >= 4) {
+            uint32_t low, high;
+            memcpy(&low, tail, 4);
+            memcpy(&high, tail + rest - 4, 4);
+            hash = (hash ^ ((uint64_t)high << 32 | low)) * multiplier;
+        } else if (rest > 0) {
+            uint64_t chunk = (uint64_t)tail[0] << 16 | (uint64_t)tail[rest / 2] << 8 | tail[rest - 1];
+            hash = (hash ^ chunk) * multiplier;
+        }
+        hash ^= hash >> 29;
+        hash *= 0xBF58476D1CE4E5B9ull;
+        return hash ^ (hash >> 32);
+    }
+
+    // Function to double the table, moving every entry to its slot in the new one. The
+    // words themselves stay in the arena.
+    void grow() {
+        std::vector<Slot> old(slots.size() * 2);
+        old.swap(slots);
+        mask = slots.size() - 1;
+        for (const Slot& slot : old) {
+            if (slot.word.data() == nullptr) {
+                continue;
+            }
+            size_t i = slot.hash & mask;
+            while (slots[i].word.data() != nullptr) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = slot;
+        }
+    }
+
+    std::vector<Slot> slots;
+    size_t mask;
+    size_t used = 0;
+    Arena arena;
+};
+
+// Function to merge every table into tables[0] as a tree: in each round, table i + step is
+// merged into table i for every i that is a multiple of 2 * step, all pairs of a round
+// in parallel. No table is touched by two threads at once, so nothing needs a lock, and
+// n tables take log2(n) rounds instead of n - 1 merges in a row.
+inline void merge_tables(std::vector<WordTable>& tables) {
+    for (size_t step = 1; step < tables.size(); step *= 2) {
+        std::vector<std::thread> merges;
+        for (size_t i = 0; i + step < tables.size(); i += 2 * step) {
+            merges.push_back(std::thread([&tables, i, step]() {
+                tables[i].merge(tables[i + step]);
+                tables[i + step] = WordTable();
+            }));
+        }
+        for (auto& t : merges) {
+            t.join();
+        }
+    }
+}
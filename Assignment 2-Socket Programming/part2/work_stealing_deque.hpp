@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+// Fixed-capacity Chase-Lev work-stealing deque. Its owner pushes and pops at the bottom,
+// newest first, without contention; other threads steal from the top, oldest first,
+// with one compare-and-swap each. Owner and thieves only race for the last item. T must
+// be trivially copyable (the server stores pointers). push fails when the deque is full.
+template <typename T>
+class WorkStealingDeque {
+public:
+    // The capacity is rounded up to a power of two
+    explicit WorkStealingDeque(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        items.reset(new std::atomic<T>[size]);
+        mask = size - 1;
+    }
+
+    // Function for the owner to add an item at the bottom
+    bool push(T item) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        if (b - t > (int64_t)mask) {
+            return false;
+        }
+        items[b & mask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Function for the owner to take the newest item; false when empty
+    bool pop(T& item) {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);  // Was already empty
+            return false;
+        }
+        item = items[b & mask].load(std::memory_order_relaxed);
+        if (t == b) {
+            // The last item: whoever moves top first gets it
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Function for any other thread to take the oldest item; false when empty or when it
+    // lost a race for it
+    bool steal(T& item) {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        item = items[t & mask].load(std::memory_order_relaxed);
+        return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    // Items left, as another thread sees them; may be stale by the time it is used
+    size_t size() const {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+private:
+    std::unique_ptr<std::atomic<T>[]> items;
+    size_t mask;
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+};